@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// A blocking multi-producer, multi-consumer FIFO holding at most capacity items
+// push waits while the queue is full, pop waits while it is empty, close wakes every waiter once no more items will come
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+	// Returns false, dropping the item, if the queue was closed
+	bool push(T item)
+	{
+		std::unique_lock lock(mutex);
+		not_full.wait(lock, [&] { return closed || items.size() < capacity; });
+		if (closed)
+		{
+			return false;
+		}
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+		return true;
+	}
+
+	// Returns std::nullopt once the queue is closed and drained
+	std::optional<T> pop()
+	{
+		std::unique_lock lock(mutex);
+		not_empty.wait(lock, [&] { return closed || !items.empty(); });
+		if (items.empty())
+		{
+			return std::nullopt;
+		}
+		T item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return item;
+	}
+
+	// Items already queued can still be popped
+	void close()
+	{
+		std::lock_guard lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+
+private:
+	size_t capacity;
+	std::deque<T> items;
+	bool closed = false;
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+};
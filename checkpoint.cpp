@@ -0,0 +1,156 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_VERSION 1
+
+// Start of a checkpoint file, followed by cells_size bytes of cells in native byte order
+struct CheckpointHeader
+{
+	char magic[8];			// "EROSCKPT"
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t reserved;		// 0, aligns the counters
+	uint64_t droplet_count;
+	uint64_t seed;
+	uint64_t hash;
+	uint64_t droplets_done;
+	uint64_t cells_size;
+};
+
+static const char CHECKPOINT_MAGIC[8] = { 'E', 'R', 'O', 'S', 'C', 'K', 'P', 'T' };
+
+// Writes the checkpoint next to the old one and renames it over it once it is complete
+// Returns the problem, or an empty string if the checkpoint was written
+static std::string write_checkpoint(const std::string& file_name, const CheckpointHeader& header, const std::vector<char>& cells)
+{
+	std::string temporary_name = file_name + ".tmp";
+	{
+		std::ofstream file(temporary_name, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(cells.data(), (std::streamsize)cells.size());
+		if (!file.flush())
+		{
+			return "cannot write " + temporary_name;
+		}
+	}
+	std::error_code rename_error;
+	std::filesystem::rename(temporary_name, file_name, rename_error);
+	if (rename_error)
+	{
+		return "cannot replace " + file_name + ": " + rename_error.message();
+	}
+	return std::string();
+}
+
+CheckpointWriter::CheckpointWriter(const CheckpointSettings& settings, const CheckpointRun& run)
+	: m_settings(settings), m_run(run), m_start(clock::now()), m_last_checkpoint(m_start)
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	if (m_write.valid())
+	{
+		m_write.wait();
+	}
+}
+
+void CheckpointWriter::collect_write()
+{
+	std::string error = m_write.get();
+	if (m_error.empty())
+	{
+		m_error = error;
+	}
+}
+
+bool CheckpointWriter::offer(const void* cells, size_t size, uint64_t droplets_done)
+{
+	clock::time_point now = clock::now();
+	bool stop = m_settings.stop_after > 0.0 && std::chrono::duration<double>(now - m_start).count() >= m_settings.stop_after;
+	if (!stop && std::chrono::duration<double>(now - m_last_checkpoint).count() < m_settings.interval)
+	{
+		return true;
+	}
+	if (m_write.valid())
+	{
+		// The simulation never waits for the disk, the checkpoint is taken at a later droplet instead
+		if (!stop && m_write.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			return true;
+		}
+		collect_write();
+	}
+
+	CheckpointHeader header{};
+	std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.width = m_run.width;
+	header.height = m_run.height;
+	header.droplet_count = m_run.droplet_count;
+	header.seed = m_run.seed;
+	header.hash = m_run.hash;
+	header.droplets_done = droplets_done;
+	header.cells_size = size;
+	m_snapshot.assign(static_cast<const char*>(cells), static_cast<const char*>(cells) + size);
+	m_write = std::async(std::launch::async, [this, header]() { return write_checkpoint(m_settings.file_name, header, m_snapshot); });
+	m_last_checkpoint = now;
+	if (stop)
+	{
+		collect_write();
+		return false;
+	}
+	return true;
+}
+
+bool CheckpointWriter::finish(std::string& error)
+{
+	if (m_write.valid())
+	{
+		collect_write();
+	}
+	if (!m_error.empty())
+	{
+		error = m_error;
+		return false;
+	}
+	return true;
+}
+
+std::optional<uint64_t> load_checkpoint(const std::string& file_name, const CheckpointRun& run, void* cells, size_t size, std::string& error)
+{
+	std::ifstream file(file_name, std::ios::binary);
+	if (!file)
+	{
+		if (!std::filesystem::exists(file_name))
+		{
+			return 0;
+		}
+		error = "cannot open " + file_name;
+		return std::nullopt;
+	}
+
+	CheckpointHeader header{};
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != CHECKPOINT_VERSION)
+	{
+		error = file_name + " is not a checkpoint of this version";
+		return std::nullopt;
+	}
+	if (header.width != run.width || header.height != run.height || header.droplet_count != run.droplet_count || header.seed != run.seed
+		|| header.hash != run.hash || header.cells_size != size || header.droplets_done > run.droplet_count)
+	{
+		error = file_name + " belongs to another run, the map, the parameters and the engine must be the same to resume";
+		return std::nullopt;
+	}
+	if (!file.read(static_cast<char*>(cells), (std::streamsize)size))
+	{
+		error = file_name + " is truncated";
+		return std::nullopt;
+	}
+	return header.droplets_done;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <optional>
+#include <string>
+#include <vector>
+
+#define CHECKPOINT_EXTENSION ".ckpt"	// Appended to the output file name of a job to name its checkpoint
+#define CHECKPOINT_INTERVAL 60.0		// Default seconds between two checkpoints
+
+// Where and how often a run saves its progress
+struct CheckpointSettings
+{
+	std::string file_name;			// Empty disables checkpoints
+	double interval = CHECKPOINT_INTERVAL;	// Seconds between two checkpoints, 0 takes one whenever the previous one is written
+	double stop_after = 0.0;		// Seconds after which the run stops at its next checkpoint, 0 runs to the end
+	bool resume = false;			// Continue from the checkpoint in file_name, if there is one
+};
+
+// Identifies the run a checkpoint belongs to, a checkpoint only resumes the run that wrote it
+struct CheckpointRun
+{
+	unsigned int width = 0;
+	unsigned int height = 0;
+	uint64_t droplet_count = 0;
+	uint64_t seed = 0;
+	uint64_t hash = 0;	// Of the parameters, the engine and the cell type and layout of the eroded grid
+};
+
+// Saves snapshots of a heightmap being eroded to a checkpoint file
+// A checkpoint holds the whole buffer of the grid, ghost border included, and the number of droplets simulated. The
+// droplets draw their random numbers from a generator keyed by the seed and their index, so that number is all the
+// RNG state there is, and a run that resumes from it produces the same bytes as a run that never stopped.
+// The cells are copied between two droplets and written to a temporary file on a background thread, which then replaces
+// the checkpoint, so the simulation only waits for the copy and a killed run always leaves a complete checkpoint behind.
+class CheckpointWriter
+{
+public:
+	CheckpointWriter(const CheckpointSettings& settings, const CheckpointRun& run);
+	CheckpointWriter(const CheckpointWriter&) = delete;
+	CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+	~CheckpointWriter();
+
+	// Takes a checkpoint of the heightmap after droplets_done droplets if the interval has passed and the previous
+	// checkpoint is written, the engines call it between two droplets
+	// Returns false, after writing the checkpoint, once settings.stop_after has passed
+	template <typename Grid>
+	bool offer(const Grid& heights, uint64_t droplets_done)
+	{
+		return offer(heights.data(), Grid::buffer_size(heights.width(), heights.height()) * sizeof(typename Grid::Cell), droplets_done);
+	}
+
+	// Waits for the checkpoint being written
+	// Returns false and describes the problem in error if a checkpoint could not be written
+	bool finish(std::string& error);
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	bool offer(const void* cells, size_t size, uint64_t droplets_done);
+	void collect_write();
+
+	CheckpointSettings m_settings;
+	CheckpointRun m_run;
+	clock::time_point m_start;
+	clock::time_point m_last_checkpoint;
+	std::vector<char> m_snapshot;		// Cells being written, untouched until m_write is collected
+	std::future<std::string> m_write;	// Error of the write in flight, empty if it succeeded
+	std::string m_error;				// First write that failed
+};
+
+// Reads the buffer of a grid from a checkpoint of the run into cells, size bytes
+// Returns the number of droplets the checkpoint had simulated, 0 if the file does not exist, or std::nullopt with the
+// problem in error if the file belongs to another run or cannot be read
+std::optional<uint64_t> load_checkpoint(const std::string& file_name, const CheckpointRun& run, void* cells, size_t size, std::string& error);
+
+// Reads the cells of the run from a checkpoint into the buffer of the heightmap, see above
+template <typename Grid>
+std::optional<uint64_t> load_checkpoint(const std::string& file_name, const CheckpointRun& run, Grid& heights, std::string& error)
+{
+	return load_checkpoint(file_name, run, heights.data(), Grid::buffer_size(heights.width(), heights.height()) * sizeof(typename Grid::Cell), error);
+}
@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <tuple>
+
+#include "droplet_batch.h"
+
+// The AVX2 kernel is compiled with a target attribute and picked at runtime, so the build needs no -mavx2
+// Define DROPLET_BATCH_AVX2 to 0 to force the portable kernel
+#if !defined(DROPLET_BATCH_AVX2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DROPLET_BATCH_AVX2 1
+#endif
+
+#if DROPLET_BATCH_AVX2
+#include <immintrin.h>
+#endif
+
+// What every lane has to write back to the heightmap once all lanes have read it
+struct BatchWrites
+{
+	uint32_t active = 0;	// Lanes that stayed on the map this iteration
+	uint32_t uphill = 0;	// Lanes that deposit in place instead of moving
+	uint32_t sediment = 0;	// Downhill lanes that drop part of their load
+	int32_t row[DROPLET_BATCH_SIZE];
+	int32_t col[DROPLET_BATCH_SIZE];
+	float deposited[DROPLET_BATCH_SIZE];
+	float detached[DROPLET_BATCH_SIZE];
+	float sedimented[DROPLET_BATCH_SIZE];
+};
+
+void DropletBatch::load(unsigned int lane, const Droplet& droplet)
+{
+	row[lane] = (int32_t)droplet.point.first;
+	col[lane] = (int32_t)droplet.point.second;
+	carried_soil[lane] = droplet.carried_soil;
+	velocity[lane] = droplet.velocity;
+	step[lane] = droplet.step;
+	rng[lane] = droplet.rng;
+	alive |= 1u << lane;
+}
+
+// Portable kernel, one lane after the other
+template <typename Variant>
+static void compute_generic(const Heightmap& heights, DropletBatch& batch, BatchWrites& writes, const KernelConstants& constants)
+{
+	unsigned int width = heights.width();
+	unsigned int height = heights.height();
+
+	for (unsigned int lane = 0; lane < DROPLET_BATCH_SIZE; lane++)
+	{
+		uint32_t bit = 1u << lane;
+		if (!(batch.alive & bit))
+		{
+			continue;
+		}
+
+		std::pair<unsigned int, unsigned int> point(batch.row[lane], batch.col[lane]);
+		uint64_t counter = 2 + 2 * (uint64_t)batch.step[lane]++;
+
+		std::pair<float, float> direction = get_tangent(heights, point, constants);
+		bool random_direction = std::abs(direction.first) <= constants.resolution_vertical && std::abs(direction.second) <= constants.resolution_horizontal;
+		if (random_direction)
+		{
+			direction.first = batch.rng[lane].uniform_float(counter, -1.0f, 1.0f);
+			direction.second = batch.rng[lane].uniform_float(counter + 1, -1.0f, 1.0f);
+		}
+
+		float slope;
+		auto next_point = point;
+		if (std::abs(direction.first) > std::abs(direction.second))
+		{
+			next_point.first += direction.first > 0.0f ? -1 : 1;
+			slope = std::abs(direction.first);
+		}
+		else
+		{
+			next_point.second += direction.second > 0.0f ? -1 : 1;
+			slope = std::abs(direction.second);
+		}
+		if (next_point.first >= height || next_point.second >= width)
+		{
+			batch.alive &= ~bit;
+			continue;
+		}
+
+		float velocity = batch.velocity[lane];
+		auto [d_f, t_f] = flow_terms<Variant::power_mode>(slope, velocity, constants);
+		float t_r = constants.s_tr * slope * constants.intensity;
+		float detached_soil = constants.rain_detachment + d_f;
+		float transport_capacity = t_r + t_f;
+		float height_diff = heights[point] - heights[next_point];
+
+		writes.active |= bit;
+		writes.row[lane] = batch.row[lane];
+		writes.col[lane] = batch.col[lane];
+		float& carried_soil = batch.carried_soil[lane];
+		if (height_diff < 0.0f)
+		{
+			float deposited = carried_soil < -height_diff / 2.8f ? carried_soil : -height_diff;
+			carried_soil -= deposited;
+			writes.uphill |= bit;
+			writes.deposited[lane] = deposited;
+			batch.velocity[lane] = 0.0f;
+			if (deposited == 0.0f && (!random_direction || is_pit(heights, point)))
+			{
+				batch.skipped_steps += Variant::get_lifetime(constants) - batch.step[lane];
+				batch.alive &= ~bit;
+			}
+		}
+		else
+		{
+			carried_soil += detached_soil;
+			writes.detached[lane] = detached_soil;
+
+			float sedimented_soil = std::max(carried_soil - transport_capacity, 0.0f);
+			writes.sedimented[lane] = sedimented_soil;
+			if (sedimented_soil > 0.1f)
+			{
+				writes.sediment |= bit;
+				carried_soil -= sedimented_soil;
+			}
+
+			velocity += get_acceleration(height_diff, constants.resolution_vertical, constants);
+			batch.velocity[lane] = std::clamp(velocity, 0.0f, 32.0f);
+			batch.row[lane] = (int32_t)next_point.first;
+			batch.col[lane] = (int32_t)next_point.second;
+		}
+
+		if (batch.step[lane] >= Variant::get_lifetime(constants))
+		{
+			batch.alive &= ~bit;
+		}
+	}
+}
+
+#if DROPLET_BATCH_AVX2
+// x^(2/3) for 8 lanes, the same operations as fast_pow_2_3
+__attribute__((target("avx2")))
+static __m256 fast_pow_2_3_avx2(__m256 x)
+{
+	// Exact unsigned division by 3: (bits * 0xaaaaaaab) >> 33, with the 64-bit products of even and odd lanes computed separately
+	const __m256i reciprocal = _mm256_set1_epi32((int)0xaaaaaaabu);
+	__m256i bits = _mm256_castps_si256(x);
+	__m256i even = _mm256_srli_epi64(_mm256_mul_epu32(bits, reciprocal), 33);
+	__m256i odd = _mm256_slli_epi64(_mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(bits, 32), reciprocal), 33), 32);
+	__m256i third = _mm256_blend_epi32(even, odd, 0b10101010);
+
+	__m256 r = _mm256_castsi256_ps(_mm256_sub_epi32(_mm256_set1_epi32(0x54a2fa8c), third));
+	for (int i = 0; i < FAST_CBRT_NEWTON_STEPS; i++)
+	{
+		__m256 r3 = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(x, r), r), r);
+		r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(4.0f / 3.0f), _mm256_mul_ps(r3, _mm256_set1_ps(1.0f / 3.0f))));
+	}
+	return _mm256_mul_ps(x, r);
+}
+
+// AVX2 kernel, every lane in one register. The operations are issued in the same order as in droplet_iteration, so
+// that each lane produces bit-identical results to the portable kernel
+// std::pow has no vector counterpart here, so with PowerMode::Exact the four power terms are evaluated lane by lane
+template <typename Variant>
+__attribute__((target("avx2")))
+static void compute_avx2(const Heightmap& heights, DropletBatch& batch, BatchWrites& writes, const KernelConstants& constants)
+{
+	const float* base = heights.row(0);
+	const __m256i stride = _mm256_set1_epi32((int)heights.stride());
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i minus_one = _mm256_set1_epi32(-1);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+	const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+	__m256i alive_i = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)batch.alive), lane_bits), lane_bits);
+	__m256 alive = _mm256_castsi256_ps(alive_i);
+
+	// Tangent, gathered through the ghost border
+	__m256i row = _mm256_load_si256((const __m256i*)batch.row);
+	__m256i col = _mm256_load_si256((const __m256i*)batch.col);
+	__m256i center = _mm256_add_epi32(_mm256_mullo_epi32(row, stride), col);
+	__m256 bottom = _mm256_i32gather_ps(base, _mm256_add_epi32(center, stride), 4);
+	__m256 top = _mm256_i32gather_ps(base, _mm256_sub_epi32(center, stride), 4);
+	__m256 right = _mm256_i32gather_ps(base, _mm256_add_epi32(center, one), 4);
+	__m256 left = _mm256_i32gather_ps(base, _mm256_sub_epi32(center, one), 4);
+	__m256 dy = _mm256_mul_ps(_mm256_sub_ps(bottom, top), _mm256_set1_ps(constants.tangent_scale_vertical));
+	__m256 dx = _mm256_mul_ps(_mm256_sub_ps(right, left), _mm256_set1_ps(constants.tangent_scale_horizontal));
+
+	// Flat lanes pick a random direction, which needs 64-bit multiplies, so it is done lane by lane
+	__m256 flat = _mm256_and_ps(
+		_mm256_cmp_ps(_mm256_andnot_ps(sign_bit, dy), _mm256_set1_ps(constants.resolution_vertical), _CMP_LE_OQ),
+		_mm256_cmp_ps(_mm256_andnot_ps(sign_bit, dx), _mm256_set1_ps(constants.resolution_horizontal), _CMP_LE_OQ));
+	unsigned int flat_lanes = (unsigned int)_mm256_movemask_ps(_mm256_and_ps(flat, alive));
+	unsigned int pit_lanes = 0;
+	if (flat_lanes)
+	{
+		alignas(32) float dy_lanes[DROPLET_BATCH_SIZE];
+		alignas(32) float dx_lanes[DROPLET_BATCH_SIZE];
+		_mm256_store_ps(dy_lanes, dy);
+		_mm256_store_ps(dx_lanes, dx);
+		for (unsigned int lane = 0; lane < DROPLET_BATCH_SIZE; lane++)
+		{
+			if (flat_lanes & (1u << lane))
+			{
+				uint64_t counter = 2 + 2 * (uint64_t)batch.step[lane];
+				dy_lanes[lane] = batch.rng[lane].uniform_float(counter, -1.0f, 1.0f);
+				dx_lanes[lane] = batch.rng[lane].uniform_float(counter + 1, -1.0f, 1.0f);
+				if (is_pit(heights, std::pair<unsigned int, unsigned int>(batch.row[lane], batch.col[lane])))
+				{
+					pit_lanes |= 1u << lane;
+				}
+			}
+		}
+		dy = _mm256_load_ps(dy_lanes);
+		dx = _mm256_load_ps(dx_lanes);
+	}
+	// The alive mask is -1 in live lanes, so subtracting it counts their iteration
+	__m256i step = _mm256_load_si256((const __m256i*)batch.step);
+	_mm256_store_si256((__m256i*)batch.step, _mm256_sub_epi32(step, alive_i));
+
+	// Next point and slope
+	__m256 abs_dy = _mm256_andnot_ps(sign_bit, dy);
+	__m256 abs_dx = _mm256_andnot_ps(sign_bit, dx);
+	__m256 vertical = _mm256_cmp_ps(abs_dy, abs_dx, _CMP_GT_OQ);
+	__m256i vertical_i = _mm256_castps_si256(vertical);
+	__m256i row_step = _mm256_blendv_epi8(one, minus_one, _mm256_castps_si256(_mm256_cmp_ps(dy, zero, _CMP_GT_OQ)));
+	__m256i col_step = _mm256_blendv_epi8(one, minus_one, _mm256_castps_si256(_mm256_cmp_ps(dx, zero, _CMP_GT_OQ)));
+	__m256i next_row = _mm256_add_epi32(row, _mm256_and_si256(vertical_i, row_step));
+	__m256i next_col = _mm256_add_epi32(col, _mm256_andnot_si256(vertical_i, col_step));
+	__m256 slope = _mm256_blendv_ps(abs_dx, abs_dy, vertical);
+
+	__m256i in_bounds = _mm256_and_si256(
+		_mm256_and_si256(_mm256_cmpgt_epi32(next_row, minus_one), _mm256_cmpgt_epi32(_mm256_set1_epi32((int)heights.height()), next_row)),
+		_mm256_and_si256(_mm256_cmpgt_epi32(next_col, minus_one), _mm256_cmpgt_epi32(_mm256_set1_epi32((int)heights.width()), next_col)));
+	__m256i active_i = _mm256_and_si256(alive_i, in_bounds);
+	__m256 active = _mm256_castsi256_ps(active_i);
+
+	// Transport equations
+	__m256 velocity = _mm256_load_ps(batch.velocity);
+	__m256 d_f, t_f;
+	if constexpr (Variant::power_mode == PowerMode::Fast)
+	{
+		__m256 flow = _mm256_mul_ps(slope, velocity);
+		__m256 flow_2_3 = fast_pow_2_3_avx2(flow);
+		d_f = _mm256_mul_ps(_mm256_set1_ps(constants.s_df), flow_2_3);
+		t_f = _mm256_mul_ps(_mm256_set1_ps(constants.s_tf), _mm256_mul_ps(flow, flow_2_3));
+	}
+	else
+	{
+		alignas(32) float slope_lanes[DROPLET_BATCH_SIZE];
+		alignas(32) float velocity_lanes[DROPLET_BATCH_SIZE];
+		alignas(32) float d_f_lanes[DROPLET_BATCH_SIZE];
+		alignas(32) float t_f_lanes[DROPLET_BATCH_SIZE];
+		_mm256_store_ps(slope_lanes, slope);
+		_mm256_store_ps(velocity_lanes, velocity);
+		for (unsigned int lane = 0; lane < DROPLET_BATCH_SIZE; lane++)
+		{
+			std::tie(d_f_lanes[lane], t_f_lanes[lane]) = flow_terms<Variant::power_mode>(slope_lanes[lane], velocity_lanes[lane], constants);
+		}
+		d_f = _mm256_load_ps(d_f_lanes);
+		t_f = _mm256_load_ps(t_f_lanes);
+	}
+	__m256 t_r = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(constants.s_tr), slope), _mm256_set1_ps(constants.intensity));
+	__m256 detached_soil = _mm256_add_ps(_mm256_set1_ps(constants.rain_detachment), d_f);
+	__m256 transport_capacity = _mm256_add_ps(t_r, t_f);
+
+	__m256i next_center = _mm256_add_epi32(_mm256_mullo_epi32(next_row, stride), next_col);
+	__m256 height_diff = _mm256_sub_ps(_mm256_i32gather_ps(base, center, 4), _mm256_mask_i32gather_ps(zero, base, next_center, active, 4));
+	__m256 uphill = _mm256_cmp_ps(height_diff, zero, _CMP_LT_OQ);
+
+	// Uphill: deposit in place
+	__m256 carried_soil = _mm256_load_ps(batch.carried_soil);
+	__m256 negated_diff = _mm256_xor_ps(height_diff, sign_bit);
+	__m256 deposited = _mm256_blendv_ps(negated_diff, carried_soil, _mm256_cmp_ps(carried_soil, _mm256_div_ps(negated_diff, _mm256_set1_ps(2.8f)), _CMP_LT_OQ));
+	__m256 soil_uphill = _mm256_sub_ps(carried_soil, deposited);
+
+	// Downhill: detach, drop what exceeds the capacity and accelerate
+	__m256 soil_downhill = _mm256_add_ps(carried_soil, detached_soil);
+	__m256 sedimented_soil = _mm256_max_ps(zero, _mm256_sub_ps(soil_downhill, transport_capacity));
+	__m256 sediment = _mm256_cmp_ps(sedimented_soil, _mm256_set1_ps(0.1f), _CMP_GT_OQ);
+	soil_downhill = _mm256_blendv_ps(soil_downhill, _mm256_sub_ps(soil_downhill, sedimented_soil), sediment);
+
+	__m256 resolution = _mm256_set1_ps(constants.resolution_vertical);
+	__m256 scaled_diff = _mm256_div_ps(height_diff, _mm256_set1_ps(32.0f));
+	__m256 hypotenuse = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(resolution, resolution), _mm256_mul_ps(scaled_diff, scaled_diff)));
+	__m256 accel_friction = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(constants.gravity), _mm256_div_ps(resolution, hypotenuse)), _mm256_set1_ps(constants.friction));
+	__m256 accel_front = _mm256_mul_ps(_mm256_set1_ps(constants.gravity), _mm256_div_ps(_mm256_mul_ps(scaled_diff, scaled_diff), hypotenuse));
+	__m256 velocity_downhill = _mm256_add_ps(velocity, _mm256_mul_ps(_mm256_sub_ps(accel_front, accel_friction), resolution));
+	velocity_downhill = _mm256_blendv_ps(velocity_downhill, zero, _mm256_cmp_ps(velocity_downhill, zero, _CMP_LT_OQ));
+	velocity_downhill = _mm256_blendv_ps(velocity_downhill, _mm256_set1_ps(32.0f), _mm256_cmp_ps(_mm256_set1_ps(32.0f), velocity_downhill, _CMP_LT_OQ));
+
+	// Commit the new state of the active lanes
+	__m256i uphill_i = _mm256_castps_si256(uphill);
+	_mm256_store_ps(batch.carried_soil, _mm256_blendv_ps(carried_soil, _mm256_blendv_ps(soil_downhill, soil_uphill, uphill), active));
+	_mm256_store_ps(batch.velocity, _mm256_blendv_ps(velocity, _mm256_blendv_ps(velocity_downhill, zero, uphill), active));
+	_mm256_store_si256((__m256i*)batch.row, _mm256_blendv_epi8(row, _mm256_blendv_epi8(next_row, row, uphill_i), active_i));
+	_mm256_store_si256((__m256i*)batch.col, _mm256_blendv_epi8(col, _mm256_blendv_epi8(next_col, col, uphill_i), active_i));
+
+	unsigned int active_lanes = (unsigned int)_mm256_movemask_ps(active);
+	__m256i lifetime = _mm256_set1_epi32((int)Variant::get_lifetime(constants));
+	__m256i evaporated = _mm256_cmpgt_epi32(lifetime, _mm256_load_si256((const __m256i*)batch.step));
+	batch.alive = active_lanes & (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(evaporated));
+
+	// Stalled lanes, see droplet_iteration: uphill, nothing deposited, and the same step again on the next iteration
+	unsigned int stalled_lanes = active_lanes & (unsigned int)_mm256_movemask_ps(_mm256_and_ps(uphill, _mm256_cmp_ps(deposited, zero, _CMP_EQ_OQ)))
+		& (~flat_lanes | pit_lanes);
+	for (unsigned int lanes = stalled_lanes; lanes; lanes &= lanes - 1)
+	{
+		batch.skipped_steps += Variant::get_lifetime(constants) - batch.step[std::countr_zero(lanes)];
+	}
+	batch.alive &= ~stalled_lanes;
+
+	writes.active = active_lanes;
+	writes.uphill = (unsigned int)_mm256_movemask_ps(uphill);
+	writes.sediment = (unsigned int)_mm256_movemask_ps(sediment);
+	_mm256_storeu_si256((__m256i*)writes.row, row);
+	_mm256_storeu_si256((__m256i*)writes.col, col);
+	_mm256_storeu_ps(writes.deposited, deposited);
+	_mm256_storeu_ps(writes.detached, detached_soil);
+	_mm256_storeu_ps(writes.sedimented, sedimented_soil);
+}
+
+static bool supports_avx2()
+{
+	static const bool supported = __builtin_cpu_supports("avx2");
+	return supported;
+}
+#endif
+
+const char* droplet_batch_isa()
+{
+#if DROPLET_BATCH_AVX2
+	if (supports_avx2())
+	{
+		return "avx2";
+	}
+#endif
+	return "generic";
+}
+
+// Applies the writes of every active lane in lane order, exactly as droplet_iteration would
+template <bool SoftBrush>
+static void apply_writes(Heightmap& heights, const BatchWrites& writes)
+{
+	for (unsigned int lane = 0; lane < DROPLET_BATCH_SIZE; lane++)
+	{
+		uint32_t bit = 1u << lane;
+		if (!(writes.active & bit))
+		{
+			continue;
+		}
+
+		std::pair<unsigned int, unsigned int> point(writes.row[lane], writes.col[lane]);
+		if (writes.uphill & bit)
+		{
+			apply_modification<SoftBrush>(heights, point, writes.deposited[lane] * 0.75f);
+			heights[point] += writes.deposited[lane] * 2.8f * 0.25f;
+		}
+		else
+		{
+			apply_modification<SoftBrush>(heights, point, -writes.detached[lane]);
+			if (writes.sediment & bit)
+			{
+				apply_modification<SoftBrush>(heights, point, writes.sedimented[lane]);
+			}
+		}
+	}
+}
+
+template <typename Variant>
+unsigned int droplet_batch_iteration(Heightmap& heights, DropletBatch& batch, const KernelConstants& constants)
+{
+	unsigned int advanced = std::popcount(batch.alive);
+	BatchWrites writes;
+#if DROPLET_BATCH_AVX2
+	if (supports_avx2())
+	{
+		compute_avx2<Variant>(heights, batch, writes, constants);
+	}
+	else
+#endif
+	{
+		compute_generic<Variant>(heights, batch, writes, constants);
+	}
+	apply_writes<Variant::soft_brush>(heights, writes);
+	return advanced;
+}
+
+DropletSteps erode_batched(Heightmap& heights, const ErosionParams& params, uint64_t droplet_count)
+{
+	return dispatch_kernel(params, [&]<typename Variant>()
+	{
+		unsigned int width = heights.width();
+		unsigned int height = heights.height();
+		uint64_t pixel_count = (uint64_t)width * height;
+		KernelConstants constants(params, width, height);
+
+		DropletBatch batch;
+		uint64_t next_droplet = 0;
+		DropletSteps steps;
+		while (true)
+		{
+			for (unsigned int lane = 0; lane < DROPLET_BATCH_SIZE && next_droplet < droplet_count; lane++)
+			{
+				if (!(batch.alive & (1u << lane)))
+				{
+					// The border lags behind the edge cells by at most one droplet per pixel
+					if (next_droplet % pixel_count == 0)
+					{
+						heights.refresh_border();
+					}
+					batch.load(lane, spawn_droplet(params.seed, next_droplet++, params.rng_margins, height - params.rng_margins, params.rng_margins, width - params.rng_margins));
+				}
+			}
+			if (!batch.alive)
+			{
+				steps.skipped_steps = batch.skipped_steps;
+				return steps;
+			}
+			steps.steps += droplet_batch_iteration<Variant>(heights, batch, constants);
+		}
+	});
+}
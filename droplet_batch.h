@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include "erosion.h"
+
+#define DROPLET_BATCH_SIZE 8	// One droplet per lane of an AVX2 register
+
+// Structure-of-arrays state of DROPLET_BATCH_SIZE droplets that are advanced in lockstep
+// Lanes whose bit is cleared in the alive mask are masked out: their point stays where the droplet died, so that the
+// gathers of the kernel can still read them safely
+struct alignas(32) DropletBatch
+{
+	int32_t row[DROPLET_BATCH_SIZE] = {};
+	int32_t col[DROPLET_BATCH_SIZE] = {};
+	float carried_soil[DROPLET_BATCH_SIZE] = {};
+	float velocity[DROPLET_BATCH_SIZE] = {};
+	uint32_t step[DROPLET_BATCH_SIZE] = {};
+	CounterRng rng[DROPLET_BATCH_SIZE] = {};
+	uint32_t alive = 0;
+	uint64_t skipped_steps = 0;	// Iterations left to the lanes that stalled, see droplet_iteration
+
+	void load(unsigned int lane, const Droplet& droplet);
+};
+
+// Name of the instruction set droplet_batch_iteration dispatches to on this machine
+const char* droplet_batch_isa();
+
+// Advances every live lane of the batch by a single iteration, with the same physics as droplet_iteration
+// All lanes read the heightmap before any of them writes to it, the writes are then applied lane by lane, so lanes that
+// touch the same cells never lose an update
+// Returns the number of lanes that were advanced
+// Modifies: heights
+template <typename Variant>
+unsigned int droplet_batch_iteration(Heightmap& heights, DropletBatch& batch, const KernelConstants& constants);
+
+// Simulates droplet_count droplets, DROPLET_BATCH_SIZE at a time, refilling a lane as soon as its droplet dies
+// Returns the total number of droplet iterations, and of those skipped by stalled droplets
+// Modifies: heights
+DropletSteps erode_batched(Heightmap& heights, const ErosionParams& params, uint64_t droplet_count);
@@ -0,0 +1,613 @@
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "erosion.h"
+#include "droplet_batch.h"
+#include "parallel.h"
+#include "pyramid.h"
+
+template <typename Grid>
+uint64_t erode_sequential(Grid& heights, const ErosionParams& params, uint64_t droplet_count, uint64_t first_droplet, const DropletProgress& progress)
+{
+	return dispatch_kernel(params, [&]<typename Variant>()
+	{
+		unsigned int width = heights.width();
+		unsigned int height = heights.height();
+		uint64_t pixel_count = (uint64_t)width * height;
+		KernelConstants constants(params, width, height);
+		auto&& terrain = grid_terrain(heights);
+
+		uint64_t steps = 0;
+		for (uint64_t i = first_droplet; i < droplet_count; i++)
+		{
+			// The border lags behind the edge cells by at most one droplet per pixel
+			if (i % pixel_count == 0)
+			{
+				heights.refresh_border();
+			}
+			Droplet droplet = spawn_droplet(params.seed, i, params.rng_margins, height - params.rng_margins, params.rng_margins, width - params.rng_margins);
+			steps += erosion_step<Variant>(terrain, droplet, constants);
+			if (progress && (i + 1) % PROGRESS_INTERVAL == 0 && i + 1 < droplet_count && !progress(i + 1))
+			{
+				break;
+			}
+		}
+		return steps;
+	});
+}
+
+// A rectangular region of the heightmap, together with the droplets that were handed off to it by neighbouring tiles
+struct Tile
+{
+	unsigned int row_begin, row_end;
+	unsigned int col_begin, col_end;
+	unsigned int phase;
+	std::vector<Droplet> inbox[4];	// Droplets handed off to this tile since it last ran, by the phase of the tile they left
+	std::vector<std::pair<size_t, Droplet>> outbox;	// Droplets that left this tile during its last run, with the index of the tile they entered
+
+	bool contains(std::pair<unsigned int, unsigned int> point) const
+	{
+		return point.first >= row_begin && point.first < row_end && point.second >= col_begin && point.second < col_end;
+	}
+};
+
+// A pass of erode_tiled over every tile, which spawns one droplet per pixel while its index is below droplets_per_pixel
+// and otherwise only resumes the droplets that the previous round handed off
+struct TiledRound
+{
+	unsigned int next_step = 0;
+	uint64_t resumed_droplets = 0;	// Droplets taken from the inboxes so far
+};
+
+// Same droplet budget and physics as the sequential loop in erode_image, but the heightmap is split into tiles of four
+// phases in a 2x2 checkerboard. A droplet only touches the 3x3 neighbourhood around its current point, so two tiles of the
+// same phase can never modify the same cell and are simulated in parallel. Droplets that walk out of their tile are
+// suspended and handed off to the inbox of the tile they entered, which resumes them the next time it runs.
+// Every round runs the tiles phase after phase, but a tile only shares cells and handoffs with the tile rows next to it,
+// so the rounds sweep the map as wavefronts: step k of a round runs phases 0 and 1 on tile row 2k and phases 2 and 3 on
+// tile row 2k - 1, and every round follows at least two steps behind the one before it. This runs each tile after exactly
+// the same neighbours as running whole rounds one phase at a time would, while only a band of tile rows, and the droplets
+// in flight in it, is in use at any time.
+// The result is bitwise identical for any thread count: the tiling does not depend on it, every tile is simulated by a
+// single thread, and the handoffs are collected per tile and moved to the inboxes in tile order once a phase is over.
+// release_rows, if set, is called after every step with the rows above the rounds that still spawn droplets, see erode_mapped
+// Modifies: heights
+template <typename Variant, typename Grid>
+static void erode_tiled(Grid& heights, const ErosionParams& params, unsigned int thread_count, const ReleaseRows& release_rows)
+{
+	unsigned int width = heights.width();
+	unsigned int height = heights.height();
+	KernelConstants constants(params, width, height);
+	auto&& terrain = grid_terrain(heights);
+
+	unsigned int tile_size = TILE_SIZE;
+	unsigned int tiles_x = (width + tile_size - 1) / tile_size;
+	unsigned int tiles_y = (height + tile_size - 1) / tile_size;
+
+	std::vector<Tile> tiles(tiles_x * tiles_y);
+	for (unsigned int ty = 0; ty < tiles_y; ty++)
+	{
+		for (unsigned int tx = 0; tx < tiles_x; tx++)
+		{
+			Tile& tile = tiles[ty * tiles_x + tx];
+			tile.row_begin = ty * tile_size;
+			tile.row_end = std::min(height, (ty + 1) * tile_size);
+			tile.col_begin = tx * tile_size;
+			tile.col_end = std::min(width, (tx + 1) * tile_size);
+			tile.phase = (ty % 2) * 2 + tx % 2;
+		}
+	}
+	auto tile_of = [&](std::pair<unsigned int, unsigned int> point)
+	{
+		return (size_t)(point.first / tile_size) * tiles_x + point.second / tile_size;
+	};
+
+	// Runs the droplet until it dies or leaves the tile, in which case it is handed off to the neighbouring tile
+	auto run_droplet = [&](Tile& tile, Droplet droplet)
+	{
+		while (droplet_iteration<Variant>(terrain, droplet, constants))
+		{
+			if (!tile.contains(droplet.point))
+			{
+				tile.outbox.emplace_back(tile_of(droplet.point), droplet);
+				return;
+			}
+		}
+	};
+
+	// Resumes the handed off droplets in the order in which the phases ran since the tile last did, then spawns the
+	// droplets of the round
+	auto run_tile = [&](unsigned int round, size_t tile_index)
+	{
+		Tile& tile = tiles[tile_index];
+		for (unsigned int offset = 1; offset < 4; offset++)
+		{
+			// Only tiles of the same phase run at the same time, so nobody else touches this inbox
+			std::vector<Droplet> handed_off = std::move(tile.inbox[(tile.phase + offset) % 4]);
+			tile.inbox[(tile.phase + offset) % 4].clear();
+			for (const Droplet& droplet : handed_off)
+			{
+				run_droplet(tile, droplet);
+			}
+		}
+
+		if (round >= params.droplets_per_pixel)
+		{
+			return;
+		}
+		unsigned int row_min = std::max<unsigned int>(tile.row_begin, params.rng_margins);
+		unsigned int row_max = std::min<unsigned int>(tile.row_end - 1, height - params.rng_margins);
+		unsigned int col_min = std::max<unsigned int>(tile.col_begin, params.rng_margins);
+		unsigned int col_max = std::min<unsigned int>(tile.col_end - 1, width - params.rng_margins);
+		if (row_min > row_max || col_min > col_max)
+		{
+			return;
+		}
+
+		// Droplets are indexed by round and spawn cell, so that their random numbers do not depend on the tiling
+		for (unsigned int row = row_min; row <= row_max; row++)
+		{
+			for (unsigned int col = col_min; col <= col_max; col++)
+			{
+				uint64_t index = (uint64_t)round * width * height + (uint64_t)row * width + col;
+				run_droplet(tile, spawn_droplet(params.seed, index, row_min, row_max, col_min, col_max));
+			}
+		}
+	};
+
+	// A round refreshes the ghost border of every row once, just ahead of its first tile that reads the row: the tiles of
+	// step k reach one row past tile row 2k
+	unsigned int step_count = tiles_y / 2 + 1;
+	auto refreshed_rows_end = [&](unsigned int step) { return std::min(height, (2 * step + 1) * tile_size + 1); };
+
+	std::vector<TiledRound> rounds;
+	size_t first_active = 0;
+	for (;;)
+	{
+		// Rounds past droplets_per_pixel only resume handed off droplets, one starts once the round before it has resumed
+		// any, so the wavefronts end with at most one round that finds nothing to do
+		bool previous_ahead = first_active == rounds.size() || rounds.back().next_step >= 2;
+		bool spawning = rounds.size() < params.droplets_per_pixel;
+		bool resuming = !rounds.empty() && (rounds.size() <= params.droplets_per_pixel || rounds.back().resumed_droplets > 0);
+		if (previous_ahead && (spawning || resuming))
+		{
+			rounds.emplace_back();
+		}
+		if (first_active == rounds.size())
+		{
+			break;
+		}
+
+		// A round only steps while the one before it is two steps ahead, so that the tiles running at the same time are at
+		// least three tile rows apart and never share cells or inboxes
+		std::vector<unsigned int> stepping;
+		for (size_t i = first_active; i < rounds.size(); i++)
+		{
+			if (i == first_active || rounds[i - 1].next_step >= rounds[i].next_step + 2)
+			{
+				stepping.push_back((unsigned int)i);
+			}
+		}
+		for (unsigned int round : stepping)
+		{
+			// The last steps have no rows left to refresh when the bottom tile row is short
+			unsigned int step = rounds[round].next_step;
+			unsigned int rows_begin = step == 0 ? 0 : refreshed_rows_end(step - 1);
+			if (rows_begin < refreshed_rows_end(step))
+			{
+				heights.refresh_border(rows_begin, refreshed_rows_end(step));
+			}
+		}
+
+		for (unsigned int phase = 0; phase < 4; phase++)
+		{
+			std::vector<std::pair<unsigned int, size_t>> group;	// Round and tile index
+			for (unsigned int round : stepping)
+			{
+				// Wraps around past tiles_y for phases 2 and 3 of step 0
+				unsigned int tile_row = phase < 2 ? 2 * rounds[round].next_step : 2 * rounds[round].next_step - 1;
+				if (tile_row >= tiles_y)
+				{
+					continue;
+				}
+				for (unsigned int tx = phase % 2; tx < tiles_x; tx += 2)
+				{
+					size_t tile_index = (size_t)tile_row * tiles_x + tx;
+					for (const std::vector<Droplet>& inbox : tiles[tile_index].inbox)
+					{
+						rounds[round].resumed_droplets += inbox.size();
+					}
+					group.emplace_back(round, tile_index);
+				}
+			}
+
+			parallel_for(thread_count, group.size(), [&](size_t i) { run_tile(group[i].first, group[i].second); });
+
+			// The target tiles belong to other phases and are idle, merging in a fixed order keeps the inboxes deterministic
+			for (const auto& [round, tile_index] : group)
+			{
+				for (const auto& [target, droplet] : tiles[tile_index].outbox)
+				{
+					tiles[target].inbox[phase].push_back(droplet);
+				}
+				// Released rather than cleared, so that the droplets in flight are all the memory the tiles hold
+				std::vector<std::pair<size_t, Droplet>>().swap(tiles[tile_index].outbox);
+			}
+		}
+
+		for (unsigned int round : stepping)
+		{
+			rounds[round].next_step++;
+		}
+		while (first_active < rounds.size() && rounds[first_active].next_step == step_count)
+		{
+			first_active++;
+		}
+
+		if (release_rows)
+		{
+			// The rounds behind the newest one that spawns droplets only resume the droplets handed off to them, which
+			// touches few tiles, so everything above it is released after every step and only those tiles come back
+			// Spawning rounds that have not started yet begin at the top
+			unsigned int step = rounds.size() < params.droplets_per_pixel ? 0 : rounds[params.droplets_per_pixel - 1].next_step;
+			unsigned int rows_in_use = step == step_count ? height : step == 0 ? 0 : std::min(height, (2 * step - 1) * tile_size - 1);
+			if (rows_in_use > 0)
+			{
+				release_rows(0, rows_in_use);
+			}
+		}
+	}
+}
+
+template <typename Grid>
+void erode_tiled(Grid& heights, const ErosionParams& params, unsigned int thread_count, const ReleaseRows& release_rows)
+{
+	dispatch_kernel(params, [&]<typename Variant>() { erode_tiled<Variant>(heights, params, thread_count, release_rows); });
+}
+
+template <typename Grid>
+uint64_t erode_epochs(Grid& heights, const ErosionParams& params, uint64_t droplet_count, unsigned int thread_count, uint64_t first_droplet, const DropletProgress& progress)
+{
+	return dispatch_kernel(params, [&]<typename Variant>()
+	{
+		unsigned int width = heights.width();
+		unsigned int height = heights.height();
+		KernelConstants constants(params, width, height);
+
+		uint64_t epoch_size = std::max(1u, params.epoch_size);
+		size_t chunk_count = (epoch_size + EPOCH_CHUNK_SIZE - 1) / EPOCH_CHUNK_SIZE;
+		// Kept across epochs, so that the buffers only allocate until they reach their working size
+		std::vector<HeightDeltas> chunks(chunk_count);
+		std::vector<uint64_t> chunk_steps(chunk_count);
+
+		uint64_t steps = 0;
+		for (uint64_t epoch_begin = first_droplet; epoch_begin < droplet_count; epoch_begin += epoch_size)
+		{
+			uint64_t epoch_end = std::min(droplet_count, epoch_begin + epoch_size);
+			heights.refresh_border();
+
+			parallel_for(thread_count, chunk_count, [&](size_t chunk)
+			{
+				HeightDeltas& deltas = chunks[chunk];
+				deltas.deltas.clear();
+				chunk_steps[chunk] = 0;
+				auto own_writes = std::make_unique<OwnWrites>();
+				EpochTerrain<Grid> terrain{ heights, deltas, *own_writes };
+
+				uint64_t begin = std::min(epoch_end, epoch_begin + chunk * EPOCH_CHUNK_SIZE);
+				uint64_t end = std::min(epoch_end, begin + EPOCH_CHUNK_SIZE);
+				for (uint64_t i = begin; i < end; i++)
+				{
+					Droplet droplet = spawn_droplet(params.seed, i, params.rng_margins, height - params.rng_margins, params.rng_margins, width - params.rng_margins);
+					own_writes->reset();
+					while (droplet_iteration<Variant>(terrain, droplet, constants));
+					chunk_steps[chunk] += droplet.step;
+				}
+			});
+
+			// The epoch barrier: float cells sum their deltas in chunk order, so that the rounding is the same for any
+			// thread count, fixed-point sums do not depend on the order and the chunks are merged in parallel
+			if constexpr (std::is_same_v<typename Grid::Cell, int32_t>)
+			{
+				parallel_for(thread_count, chunk_count, [&](size_t chunk)
+				{
+					AtomicTerrain<Grid> merged{ heights };
+					apply_deltas<Variant::soft_brush>(merged, chunks[chunk]);
+				});
+			}
+			else
+			{
+				auto&& terrain = grid_terrain(heights);
+				for (size_t chunk = 0; chunk < chunk_count; chunk++)
+				{
+					apply_deltas<Variant::soft_brush>(terrain, chunks[chunk]);
+				}
+			}
+			for (size_t chunk = 0; chunk < chunk_count; chunk++)
+			{
+				steps += chunk_steps[chunk];
+			}
+			if (progress && epoch_end < droplet_count && !progress(epoch_end))
+			{
+				break;
+			}
+		}
+		return steps;
+	});
+}
+
+template <typename Grid>
+AtomicErosionStats erode_atomic(Grid& heights, const ErosionParams& params, uint64_t droplet_count, unsigned int thread_count)
+{
+	return dispatch_kernel(params, [&]<typename Variant>()
+	{
+		unsigned int width = heights.width();
+		unsigned int height = heights.height();
+		uint64_t pixel_count = (uint64_t)width * height;
+		KernelConstants constants(params, width, height);
+
+		AtomicErosionStats stats;
+		for (uint64_t round_begin = 0; round_begin < droplet_count; round_begin += pixel_count)
+		{
+			// Same border lag as erode_sequential: the border is refreshed between rounds of one droplet per pixel
+			heights.refresh_border();
+			uint64_t round_end = std::min(droplet_count, round_begin + pixel_count);
+			size_t chunk_count = (round_end - round_begin + ATOMIC_CHUNK_SIZE - 1) / ATOMIC_CHUNK_SIZE;
+			std::vector<AtomicErosionStats> chunk_stats(chunk_count);
+
+			parallel_for(thread_count, chunk_count, [&](size_t chunk)
+			{
+				AtomicTerrain<Grid> terrain{ heights };
+				uint64_t begin = round_begin + chunk * ATOMIC_CHUNK_SIZE;
+				uint64_t end = std::min(round_end, begin + ATOMIC_CHUNK_SIZE);
+				uint64_t steps = 0;
+				for (uint64_t i = begin; i < end; i++)
+				{
+					Droplet droplet = spawn_droplet(params.seed, i, params.rng_margins, height - params.rng_margins, params.rng_margins, width - params.rng_margins);
+					while (droplet_iteration<Variant>(terrain, droplet, constants));
+					steps += droplet.step;
+				}
+				chunk_stats[chunk] = { steps, terrain.updates, terrain.contended_updates };
+			});
+
+			for (const AtomicErosionStats& chunk : chunk_stats)
+			{
+				stats.steps += chunk.steps;
+				stats.updates += chunk.updates;
+				stats.contended_updates += chunk.contended_updates;
+			}
+		}
+		return stats;
+	});
+}
+
+// Every kind of heightmap the engines run on, see erode_heightmap
+#define INSTANTIATE_ENGINES(Grid) \
+	template uint64_t erode_sequential(Grid& heights, const ErosionParams& params, uint64_t droplet_count, uint64_t first_droplet, const DropletProgress& progress); \
+	template void erode_tiled(Grid& heights, const ErosionParams& params, unsigned int thread_count, const ReleaseRows& release_rows); \
+	template uint64_t erode_epochs(Grid& heights, const ErosionParams& params, uint64_t droplet_count, unsigned int thread_count, uint64_t first_droplet, const DropletProgress& progress); \
+	template AtomicErosionStats erode_atomic(Grid& heights, const ErosionParams& params, uint64_t droplet_count, unsigned int thread_count);
+
+INSTANTIATE_ENGINES(Heightmap)
+INSTANTIATE_ENGINES(BlockedHeightmap)
+INSTANTIATE_ENGINES(FixedHeightmap)
+INSTANTIATE_ENGINES(BlockedFixedHeightmap)
+
+void erode_mapped(MappedHeightmapFile& file, const ErosionParams& params, unsigned int thread_count)
+{
+	erode_tiled(file.heights(), params, thread_count, [&](unsigned int row_begin, unsigned int row_end)
+	{
+		file.release_rows(row_begin, row_end);
+	});
+}
+
+// Hashes everything that decides the droplets of a run besides the map, the droplet count and the seed, so that a
+// checkpoint only resumes the run that wrote it. The thread count is left out, it does not change the output of the
+// engines that take checkpoints.
+template <typename Grid>
+static uint64_t checkpoint_hash(const ErosionParams& params, ErosionEngine engine)
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](const auto& value)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+		for (size_t i = 0; i < sizeof(value); i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	};
+	mix(params.evaporation);
+	mix(params.intensity);
+	mix(params.s_dr);
+	mix(params.s_df);
+	mix(params.s_tf);
+	mix(params.s_tr);
+	mix(params.starting_water);
+	mix(params.friction);
+	mix(params.gravity);
+	mix(params.scale_vertical);
+	mix(params.scale_horizontal);
+	mix(params.soft_brush);
+	mix(params.power_mode);
+	mix(params.rng_margins);
+	mix(engine == ErosionEngine::Epochs ? params.epoch_size : 0u);
+	for (unsigned int droplets : params.pyramid_droplets)
+	{
+		mix(droplets);
+	}
+	mix(engine);
+	mix(sizeof(typename Grid::Cell));
+	mix(std::is_same_v<typename Grid::Cell, int32_t>);
+	mix(Grid::ROW_MAJOR);
+	return hash;
+}
+
+// Runs the selected engine on any kind of heightmap, saving checkpoints unless checkpoint.file_name is empty
+// Returns false and describes the problem in error if the run cannot take its checkpoints or stopped at one
+template <typename Grid>
+static bool erode_grid(Grid& heights, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count, const CheckpointSettings& checkpoint, std::string& error)
+{
+	uint64_t droplet_count = (uint64_t)heights.width() * heights.height() * params.droplets_per_pixel;
+	if (!checkpoint.file_name.empty())
+	{
+		CheckpointRun run{ heights.width(), heights.height(), droplet_count, params.seed, checkpoint_hash<Grid>(params, engine) };
+		uint64_t first_droplet = 0;
+		if (checkpoint.resume)
+		{
+			std::optional<uint64_t> resumed = load_checkpoint(checkpoint.file_name, run, heights, error);
+			if (!resumed)
+			{
+				return false;
+			}
+			first_droplet = *resumed;
+		}
+
+		CheckpointWriter writer(checkpoint, run);
+		uint64_t stopped_at = droplet_count;
+		DropletProgress progress = [&](uint64_t droplets_done)
+		{
+			bool proceed = writer.offer(heights, droplets_done);
+			stopped_at = proceed ? droplet_count : droplets_done;
+			return proceed;
+		};
+		if (engine == ErosionEngine::Epochs)
+		{
+			erode_epochs(heights, params, droplet_count, thread_count, first_droplet, progress);
+		}
+		else
+		{
+			erode_sequential(heights, params, droplet_count, first_droplet, progress);
+		}
+		if (!writer.finish(error))
+		{
+			return false;
+		}
+		if (stopped_at < droplet_count)
+		{
+			error = "stopped after " + std::to_string(stopped_at) + " of " + std::to_string(droplet_count) + " droplets, continue with --resume";
+			return false;
+		}
+		return true;
+	}
+
+	if (engine == ErosionEngine::Tiled)
+	{
+		erode_tiled(heights, params, thread_count);
+	}
+	else if (engine == ErosionEngine::Epochs)
+	{
+		erode_epochs(heights, params, droplet_count, thread_count);
+	}
+	else if (engine == ErosionEngine::Atomic)
+	{
+		erode_atomic(heights, params, droplet_count, thread_count);
+	}
+	else
+	{
+		erode_sequential(heights, params, droplet_count);
+	}
+	return true;
+}
+
+// Runs the selected engine on a copy of the heightmap in another cell type or layout
+// The float heightmap is released while the copy is eroded, unless its cells belong to the caller, such as a mapped file,
+// in which case the result is copied back into them
+template <typename Grid>
+static bool erode_converted(Heightmap& heights, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count, const CheckpointSettings& checkpoint, std::string& error)
+{
+	Grid grid = convert_heightmap<Grid>(heights);
+	if (!heights.owns_buffer())
+	{
+		bool eroded = erode_grid(grid, params, engine, thread_count, checkpoint, error);
+		copy_cells(grid, heights);
+		return eroded;
+	}
+	heights = Heightmap(0, 0);
+	bool eroded = erode_grid(grid, params, engine, thread_count, checkpoint, error);
+	heights = convert_heightmap<Heightmap>(grid);
+	return eroded;
+}
+
+// Erodes a single level of the pyramid with params.droplets_per_pixel, see erode_heightmap
+static bool erode_level(Heightmap& heights, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count, const CheckpointSettings& checkpoint, std::string& error)
+{
+	if (!checkpoint.file_name.empty() && engine != ErosionEngine::Sequential && engine != ErosionEngine::Epochs)
+	{
+		error = "only the sequential and the epoch engines take checkpoints";
+		return false;
+	}
+	if (engine == ErosionEngine::Batched)
+	{
+		// The SIMD kernel only computes on floats
+		erode_batched(heights, params, (uint64_t)heights.width() * heights.height() * params.droplets_per_pixel);
+		return true;
+	}
+	if (params.fixed_point && params.blocked_layout)
+	{
+		return erode_converted<BlockedFixedHeightmap>(heights, params, engine, thread_count, checkpoint, error);
+	}
+	if (params.fixed_point)
+	{
+		return erode_converted<FixedHeightmap>(heights, params, engine, thread_count, checkpoint, error);
+	}
+	if (params.blocked_layout)
+	{
+		return erode_converted<BlockedHeightmap>(heights, params, engine, thread_count, checkpoint, error);
+	}
+	return erode_grid(heights, params, engine, thread_count, checkpoint, error);
+}
+
+bool erode_heightmap(Heightmap& heights, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count, const CheckpointSettings& checkpoint, std::string& error)
+{
+	// A resumed run finds the finest level in the checkpoint, whatever the coarse levels would have added
+	bool resuming = checkpoint.resume && !checkpoint.file_name.empty() && std::filesystem::exists(checkpoint.file_name);
+	unsigned int coarse_width = (heights.width() + 1) / 2;
+	unsigned int coarse_height = (heights.height() + 1) / 2;
+	if (!params.pyramid_droplets.empty() && !resuming && coarse_width >= PYRAMID_MIN_SIDE && coarse_height >= PYRAMID_MIN_SIDE)
+	{
+		// The coarse level is a pyramid of the remaining levels itself
+		ErosionParams coarse_params = params;
+		coarse_params.droplets_per_pixel = params.pyramid_droplets.front();
+		coarse_params.pyramid_droplets.erase(coarse_params.pyramid_droplets.begin());
+		Heightmap before = downsample_heightmap(heights);
+		Heightmap after = downsample_heightmap(heights);
+		erode_heightmap(after, coarse_params, engine, thread_count);
+		add_upsampled_delta(heights, before, after);
+	}
+	return erode_level(heights, params, engine, thread_count, checkpoint, error);
+}
+
+// Erodes the heightmap in place with the selected engine, thread_count is only used by the multithreaded engines
+void erode_heightmap(Heightmap& heights, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count)
+{
+	std::string error;
+	erode_heightmap(heights, params, engine, thread_count, CheckpointSettings(), error);
+}
+
+// Erodes the image in place with the selected engine, thread_count is only used by the multithreaded engines
+void erode_image(unsigned char** pixels, unsigned int width, unsigned int height, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count)
+{
+	Heightmap heights(width, height);
+
+	for (int i = 0; i < height; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			heights.at(i, j) = (float) pixels[i][j];
+		}
+	}
+
+	erode_heightmap(heights, params, engine, thread_count);
+
+	for (int i = 0; i < height; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			// To ensure type conversion safety
+			pixels[i][j] = (unsigned char)std::clamp(heights.at(i, j), 0.0f, 255.0f);
+		}
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "checkpoint.h"
+#include "erosion_kernel.h"
+#include "mapped_heightmap.h"
+
+#define MIN_TILE_SIZE 8		// Tiles must be wider than the 3x3 droplet footprint, so that tiles of the same phase never touch
+#define TILE_SIZE 32		// Side of the tiles of erode_tiled, fixed so that the output does not depend on the thread count
+
+#define EPOCH_CHUNK_SIZE 64	// Droplets of an epoch that share a delta buffer, fixed so that the output does not depend on the thread count
+#define ATOMIC_CHUNK_SIZE 256	// Droplets handed to a thread at a time by erode_atomic
+#define PROGRESS_INTERVAL 4096	// Droplets between two calls of the DropletProgress of erode_sequential
+
+static_assert(TILE_SIZE >= MIN_TILE_SIZE);
+
+// Selects how erode_image schedules the droplets
+enum class ErosionEngine
+{
+	Sequential,	// One droplet after another, the reference simulation
+	Tiled,		// Tile-partitioned multithreaded engine, see erode_tiled
+	Batched,	// DROPLET_BATCH_SIZE droplets advanced in lockstep by the SIMD kernel, see erode_batched
+	Epochs,		// Bulk-synchronous epochs of droplets that read a frozen heightmap, see erode_epochs
+	Atomic,		// Every thread runs droplets over the whole heightmap with atomic cell updates, see erode_atomic
+};
+
+// The engines below run on float or fixed-point heightmaps of either layout, see the instantiations in erosion.cpp
+
+// Called by erode_sequential and erode_epochs between two droplets with the number of droplets simulated so far, when
+// the heightmap holds everything a run that starts from the next droplet needs, see CheckpointWriter
+// Returns false to stop the run there
+using DropletProgress = std::function<bool(uint64_t droplets_done)>;
+
+// Simulates droplets [first_droplet, droplet_count) one after another, the reference simulation
+// progress, if set, is called every PROGRESS_INTERVAL droplets
+// Returns the total number of droplet iterations
+// Modifies: heights
+template <typename Grid>
+uint64_t erode_sequential(Grid& heights, const ErosionParams& params, uint64_t droplet_count, uint64_t first_droplet = 0, const DropletProgress& progress = nullptr);
+
+// Called by erode_tiled with map rows [row_begin, row_end) that only a few tiles will touch again for a while
+using ReleaseRows = std::function<void(unsigned int row_begin, unsigned int row_end)>;
+
+// Runs the droplet budget of erode_image on the tile-partitioned multithreaded engine
+// release_rows, if set, is told which rows the band of tiles in use has left behind, see erode_mapped
+// Modifies: heights
+template <typename Grid>
+void erode_tiled(Grid& heights, const ErosionParams& params, unsigned int thread_count, const ReleaseRows& release_rows = nullptr);
+
+// Simulates droplets [first_droplet, droplet_count) in epochs of params.epoch_size droplets, spread over thread_count threads
+// Every droplet of an epoch reads the heightmap as it was at the start of the epoch plus its own writes, see EpochTerrain,
+// and records its writes in the delta buffer of its chunk of EPOCH_CHUNK_SIZE droplets. The buffers are applied in chunk
+// order at the end of the epoch, or in parallel on fixed-point cells, so the result does not depend on the thread count,
+// but it drifts from erode_sequential as the epochs grow. first_droplet must start an epoch, progress, if set, is called
+// after every epoch.
+// Returns the total number of droplet iterations
+// Modifies: heights
+template <typename Grid>
+uint64_t erode_epochs(Grid& heights, const ErosionParams& params, uint64_t droplet_count, unsigned int thread_count, uint64_t first_droplet = 0, const DropletProgress& progress = nullptr);
+
+// Counters of erode_atomic
+struct AtomicErosionStats
+{
+	uint64_t steps = 0;				// Droplet iterations
+	uint64_t updates = 0;			// Cells written
+	uint64_t contended_updates = 0;	// Writes retried because another thread wrote the same cell in between
+};
+
+// Simulates droplet_count droplets on thread_count threads that share the whole heightmap, reading and writing every cell
+// atomically. Nothing is partitioned, so all threads stay busy on large maps where droplets rarely meet, but the output
+// depends on how the threads interleave.
+// Modifies: heights
+template <typename Grid>
+AtomicErosionStats erode_atomic(Grid& heights, const ErosionParams& params, uint64_t droplet_count, unsigned int thread_count);
+
+// Erodes a heightmap file larger than memory in place, on the tiled engine
+// The rounds of the tiled engine sweep the map from top to bottom, and the pages of the rows behind the band of rounds
+// that spawn droplets are handed back to the kernel after every step, so that only the band and the few tiles where later
+// rounds resume handed off droplets stay resident
+// Modifies: file
+void erode_mapped(MappedHeightmapFile& file, const ErosionParams& params, unsigned int thread_count);
+
+// Erodes the heightmap in place with the selected engine, thread_count is only used by the multithreaded engines
+// params.fixed_point and params.blocked_layout make the engine run on a converted copy, see BasicHeightmap, except for the
+// batched engine, which only computes on row-major floats
+// The result is left in the cells of heights, so heights may be the map of a MappedRowsFile
+// With params.pyramid_droplets, a half resolution copy is eroded first, itself as a pyramid of the remaining levels, and
+// the upsampled difference is added to the heightmap before it is eroded with params.droplets_per_pixel. Large valleys
+// are carved by a few droplets crossing big coarse cells, so that the full resolution needs fewer droplets for the detail.
+// Modifies: heights
+void erode_heightmap(Heightmap& heights, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count);
+
+// erode_heightmap that saves its progress to checkpoint.file_name, and starts from the checkpoint found there with
+// checkpoint.resume, see CheckpointWriter. Only the sequential and the epoch engines come to a point where no droplet is in
+// flight, the other engines cannot take checkpoints.
+// Returns false and describes the problem in error if the engine takes no checkpoints, the checkpoint belongs to another
+// run or cannot be written, or the run stopped at checkpoint.stop_after, in which case heights is left half eroded
+// Modifies: heights
+bool erode_heightmap(Heightmap& heights, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count, const CheckpointSettings& checkpoint, std::string& error);
+
+// Erodes the image in place with the selected engine, thread_count is only used by the multithreaded engines
+void erode_image(unsigned char** pixels, unsigned int width, unsigned int height, const ErosionParams& params, ErosionEngine engine, unsigned int thread_count);
@@ -0,0 +1,390 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <thread>
+
+#include "heightmap_io.h"
+#include "erosion.h"
+#include "droplet_batch.h"
+#include "pyramid.h"
+
+// Loads a PNG into a heightmap, prints the error and returns std::nullopt if the file cannot be decoded
+static std::optional<Heightmap> load_heightmap(const std::string& file_name)
+{
+	std::string error;
+	std::optional<Heightmap> heights = load_png_heightmap(file_name, error);
+	if (!heights)
+	{
+		std::cout << error << std::endl;
+	}
+	return heights;
+}
+
+// Difference between two eroded heightmaps, in levels of the 8-bit output image
+struct Deviation
+{
+	int max = 0;
+	double mean = 0.0;
+};
+
+static Deviation compare_outputs(const Heightmap& reference, const Heightmap& heights)
+{
+	Deviation deviation;
+	uint64_t total_deviation = 0;
+	for (unsigned int i = 0; i < reference.height(); i++)
+	{
+		for (unsigned int j = 0; j < reference.width(); j++)
+		{
+			int reference_pixel = (int)std::clamp(reference.at(i, j), 0.0f, 255.0f);
+			int pixel = (int)std::clamp(heights.at(i, j), 0.0f, 255.0f);
+			deviation.max = std::max(deviation.max, std::abs(reference_pixel - pixel));
+			total_deviation += std::abs(reference_pixel - pixel);
+		}
+	}
+	deviation.mean = (double)total_deviation / ((double)reference.width() * reference.height());
+	return deviation;
+}
+
+// TestData images, sorted by name
+static std::vector<std::filesystem::path> test_inputs()
+{
+	std::vector<std::filesystem::path> inputs;
+	for (const auto& entry : std::filesystem::directory_iterator(EROSION_TEST_DATA_DIR))
+	{
+		if (entry.path().extension() == ".png")
+		{
+			inputs.push_back(entry.path());
+		}
+	}
+	std::sort(inputs.begin(), inputs.end());
+	return inputs;
+}
+
+// Runs the same droplets through the scalar and the batched kernels, in both power modes, and reports steps per second
+static int benchmark_kernels(const std::string& input_file_name, uint64_t droplet_count)
+{
+	std::optional<Heightmap> input = load_heightmap(input_file_name);
+	if (!input)
+	{
+		return -1;
+	}
+	unsigned int width = input->width();
+	unsigned int height = input->height();
+	if (droplet_count == 0)
+	{
+		droplet_count = (uint64_t)width * height;
+	}
+
+	auto report = [&](const std::string& name, auto&& run)
+	{
+		Heightmap heights = *load_heightmap(input_file_name);
+		auto start = std::chrono::steady_clock::now();
+		uint64_t steps = run(heights);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		std::cout << name << ": " << droplet_count << " droplets, " << steps << " steps in " << elapsed.count() << " s, "
+			<< steps / elapsed.count() << " steps/s" << std::endl;
+	};
+
+	ErosionParams exact;
+	ErosionParams fast;
+	fast.power_mode = PowerMode::Fast;
+
+	std::string batch_name = std::string("batch x") + std::to_string(DROPLET_BATCH_SIZE) + " (" + droplet_batch_isa() + ")";
+	std::cout << input_file_name << " (" << width << "x" << height << ")" << std::endl;
+	report("scalar", [&](Heightmap& heights) { return erode_sequential(heights, exact, droplet_count); });
+	report("scalar, fast math", [&](Heightmap& heights) { return erode_sequential(heights, fast, droplet_count); });
+	report(batch_name, [&](Heightmap& heights) { return erode_batched(heights, exact, droplet_count); });
+	report(batch_name + ", fast math", [&](Heightmap& heights) { return erode_batched(heights, fast, droplet_count); });
+
+	return 0;
+}
+
+// Measures the error of the fast power approximations, first per evaluation and then on the eroded TestData images
+static int report_fast_math(unsigned int droplets_per_pixel)
+{
+	double max_error_2_3 = 0.0;
+	double max_error_5_3 = 0.0;
+	for (double x = 1e-6; x < 1e6; x *= 1.0001)
+	{
+		float value = (float)x;
+		max_error_2_3 = std::max(max_error_2_3, std::abs(fast_pow_2_3(value) / std::pow((double)value, 2.0 / 3.0) - 1.0));
+		max_error_5_3 = std::max(max_error_5_3, std::abs(fast_pow_5_3(value) / std::pow((double)value, 5.0 / 3.0) - 1.0));
+	}
+	std::cout << "max relative error over [1e-6, 1e6]: x^(2/3) " << max_error_2_3 << ", x^(5/3) " << max_error_5_3
+		<< " (documented bound " << FAST_POW_MAX_RELATIVE_ERROR << ")" << std::endl;
+
+	// Droplet paths are chaotic, so a tiny difference in one step can reroute a droplet: the per-pixel deviation of the
+	// output is far larger than the per-evaluation error, and is the number that matters for the final image
+	for (const auto& input : test_inputs())
+	{
+		std::optional<Heightmap> exact = load_heightmap(input.string());
+		std::optional<Heightmap> fast = load_heightmap(input.string());
+		if (!exact || !fast)
+		{
+			return -1;
+		}
+		unsigned int width = exact->width();
+		unsigned int height = exact->height();
+
+		uint64_t droplet_count = (uint64_t)width * height * droplets_per_pixel;
+		ErosionParams fast_params;
+		fast_params.power_mode = PowerMode::Fast;
+		erode_sequential(*exact, ErosionParams(), droplet_count);
+		erode_sequential(*fast, fast_params, droplet_count);
+
+		Deviation deviation = compare_outputs(*exact, *fast);
+		std::cout << input.filename().string() << ": max deviation " << deviation.max << " levels, mean "
+			<< deviation.mean << " levels (" << droplets_per_pixel << " droplets per pixel)" << std::endl;
+	}
+
+	return 0;
+}
+
+// Compares the epoch engine with the sequential reference on every TestData image, for a range of epoch sizes: larger
+// epochs leave more droplets to run in parallel, but each of them sees an older heightmap
+static int report_epochs(unsigned int thread_count)
+{
+	const unsigned int epoch_sizes[] = { 64, 256, 1024, 4096, 16384 };
+	auto run = [](auto&& erode)
+	{
+		auto start = std::chrono::steady_clock::now();
+		erode();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	ErosionParams params;
+	for (const auto& input : test_inputs())
+	{
+		std::optional<Heightmap> reference = load_heightmap(input.string());
+		if (!reference)
+		{
+			return -1;
+		}
+		uint64_t droplet_count = (uint64_t)reference->width() * reference->height() * params.droplets_per_pixel;
+		double reference_time = run([&] { erode_sequential(*reference, params, droplet_count); });
+		std::cout << input.filename().string() << ": sequential " << reference_time << " s" << std::endl;
+
+		for (unsigned int epoch_size : epoch_sizes)
+		{
+			Heightmap heights = *load_heightmap(input.string());
+			params.epoch_size = epoch_size;
+			double time = run([&] { erode_epochs(heights, params, droplet_count, thread_count); });
+			Deviation deviation = compare_outputs(*reference, heights);
+			std::cout << "  epoch " << epoch_size << ", " << thread_count << " threads: " << time << " s (x" << reference_time / time
+				<< "), max deviation " << deviation.max << " levels, mean " << deviation.mean << " levels" << std::endl;
+		}
+	}
+	return 0;
+}
+
+// Runs the same droplets on a side x side map, made of copies of heightmap_512, in every cell type and layout
+// North and south steps on a wide row-major map cross a whole row of memory, the blocked layout keeps the 3x3 neighbourhood
+// of a droplet within a few cache lines
+static int report_layouts(unsigned int side, uint64_t droplet_count)
+{
+	std::optional<Heightmap> tile = load_heightmap(EROSION_TEST_DATA_DIR "/heightmap_512.png");
+	if (!tile)
+	{
+		return -1;
+	}
+	Heightmap input(side, side);
+	for (unsigned int r = 0; r < side; r++)
+	{
+		for (unsigned int c = 0; c < side; c++)
+		{
+			input.at(r, c) = tile->at(r % tile->height(), c % tile->width());
+		}
+	}
+
+	ErosionParams params;
+	std::optional<Heightmap> reference;
+	auto report = [&]<typename Grid>(const std::string& name)
+	{
+		Grid heights = convert_heightmap<Grid>(input);
+		auto start = std::chrono::steady_clock::now();
+		uint64_t steps = erode_sequential(heights, params, droplet_count);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		std::cout << name << ": " << droplet_count << " droplets, " << steps << " steps in " << elapsed.count() << " s, "
+			<< steps / elapsed.count() << " steps/s";
+		Heightmap output = convert_heightmap<Heightmap>(heights);
+		if (!reference)
+		{
+			reference = std::move(output);
+		}
+		else
+		{
+			std::cout << ", mean deviation from row-major floats " << compare_outputs(*reference, output).mean << " levels";
+		}
+		std::cout << std::endl;
+	};
+
+	std::cout << side << "x" << side << " map" << std::endl;
+	report.operator()<Heightmap>("row-major float");
+	report.operator()<BlockedHeightmap>("blocked float");
+	report.operator()<FixedHeightmap>("row-major fixed point");
+	report.operator()<BlockedFixedHeightmap>("blocked fixed point");
+	return 0;
+}
+
+// Compares the atomic engine with the tiled engine on every TestData image, at the same thread count and droplet budget,
+// together with how often two threads wrote the same cell at once
+static int report_atomic(unsigned int thread_count)
+{
+	auto run = [](auto&& erode)
+	{
+		auto start = std::chrono::steady_clock::now();
+		erode();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	ErosionParams params;
+	for (const auto& input : test_inputs())
+	{
+		std::optional<Heightmap> tiled = load_heightmap(input.string());
+		if (!tiled)
+		{
+			return -1;
+		}
+		Heightmap atomic = *load_heightmap(input.string());
+		uint64_t droplet_count = (uint64_t)atomic.width() * atomic.height() * params.droplets_per_pixel;
+
+		double tiled_time = run([&] { erode_tiled(*tiled, params, thread_count); });
+		AtomicErosionStats stats;
+		double atomic_time = run([&] { stats = erode_atomic(atomic, params, droplet_count, thread_count); });
+		Deviation deviation = compare_outputs(*tiled, atomic);
+		std::cout << input.filename().string() << ", " << thread_count << " threads: tiled " << tiled_time << " s, atomic " << atomic_time
+			<< " s (x" << tiled_time / atomic_time << "), " << stats.contended_updates << " of " << stats.updates << " cell updates contended ("
+			<< 100.0 * stats.contended_updates / std::max<uint64_t>(1, stats.updates) << "%), mean deviation " << deviation.mean << " levels" << std::endl;
+	}
+	return 0;
+}
+
+// Compares pyramids of a few droplet budgets with the single-level run on every TestData image
+// Droplet paths are chaotic, so the pixels of two runs never agree; a single-level run with another seed shows how far
+// runs of matched quality drift apart. The deviation after averaging 8x8 blocks compares the valleys, and the erosion
+// depth, the mean change of the 8-bit output from the input, compares how much material was moved.
+static int report_pyramid(unsigned int thread_count)
+{
+	struct PyramidBudget
+	{
+		unsigned int droplets_per_pixel;
+		std::vector<unsigned int> pyramid_droplets;
+	};
+	const PyramidBudget budgets[] = { { 5, { 10 } }, { 4, { 8, 16 } }, { 2, { 8, 16 } }, { 1, { 8, 16 } } };
+	ErosionEngine engine = thread_count > 1 ? ErosionEngine::Tiled : ErosionEngine::Sequential;
+
+	auto valleys = [](const Heightmap& heights)
+	{
+		return downsample_heightmap(downsample_heightmap(downsample_heightmap(heights)));
+	};
+	auto depth = [](const Heightmap& input, const Heightmap& heights)
+	{
+		double total = 0.0;
+		for (unsigned int i = 0; i < input.height(); i++)
+		{
+			for (unsigned int j = 0; j < input.width(); j++)
+			{
+				total += std::abs(std::clamp(heights.at(i, j), 0.0f, 255.0f) - std::clamp(input.at(i, j), 0.0f, 255.0f));
+			}
+		}
+		return total / ((double)input.width() * input.height());
+	};
+
+	for (const auto& input_path : test_inputs())
+	{
+		std::optional<Heightmap> input = load_heightmap(input_path.string());
+		if (!input)
+		{
+			return -1;
+		}
+		auto run = [&](const ErosionParams& params, double& time)
+		{
+			Heightmap heights = *load_heightmap(input_path.string());
+			auto start = std::chrono::steady_clock::now();
+			erode_heightmap(heights, params, engine, thread_count);
+			time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			return heights;
+		};
+		auto report = [&](const std::string& name, double time, double reference_time, const Heightmap& reference, const Heightmap& heights)
+		{
+			double reference_depth = depth(*input, reference);
+			std::cout << "  " << name << ": " << time << " s (x" << reference_time / time << "), mean deviation " << compare_outputs(reference, heights).mean
+				<< " levels, " << compare_outputs(valleys(reference), valleys(heights)).mean << " on 8x8 blocks, erosion depth "
+				<< 100.0 * depth(*input, heights) / reference_depth << "% of the single level" << std::endl;
+		};
+
+		ErosionParams params;
+		double reference_time;
+		Heightmap reference = run(params, reference_time);
+		std::cout << input_path.filename().string() << ": single level, " << params.droplets_per_pixel << " droplets per pixel, " << reference_time << " s, "
+			<< thread_count << " threads" << std::endl;
+
+		ErosionParams other_seed = params;
+		other_seed.seed = params.seed + 1;
+		double time;
+		Heightmap heights = run(other_seed, time);
+		report("single level, another seed", time, reference_time, reference, heights);
+
+		for (const PyramidBudget& budget : budgets)
+		{
+			ErosionParams pyramid = params;
+			pyramid.droplets_per_pixel = budget.droplets_per_pixel;
+			pyramid.pyramid_droplets = budget.pyramid_droplets;
+			std::string name = "pyramid " + std::to_string(budget.droplets_per_pixel);
+			for (unsigned int droplets : budget.pyramid_droplets)
+			{
+				name += "," + std::to_string(droplets);
+			}
+			heights = run(pyramid, time);
+			report(name, time, reference_time, reference, heights);
+		}
+	}
+	return 0;
+}
+
+// Usage: erosion_bench [heightmap.png] [droplets]
+//        erosion_bench --fast-math-report [droplets per pixel]
+//        erosion_bench --epoch-report [threads]
+//        erosion_bench --atomic-report [threads]
+//        erosion_bench --layout-report [side] [droplets]
+//        erosion_bench --pyramid-report [threads]
+int main(int argc, char** argv)
+{
+	if (argc > 1 && strcmp(argv[1], "--pyramid-report") == 0)
+	{
+		return report_pyramid(argc > 2 ? (unsigned int)std::strtoul(argv[2], nullptr, 10) : 1);
+	}
+	if (argc > 1 && strcmp(argv[1], "--layout-report") == 0)
+	{
+		unsigned int side = argc > 2 ? (unsigned int)std::strtoul(argv[2], nullptr, 10) : 4096;
+		uint64_t droplet_count = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 262144;
+		return report_layouts(side, droplet_count);
+	}
+	if (argc > 1 && strcmp(argv[1], "--atomic-report") == 0)
+	{
+		unsigned int thread_count = argc > 2 ? (unsigned int)std::strtoul(argv[2], nullptr, 10) : 0;
+		return report_atomic(thread_count ? thread_count : std::max(1u, std::thread::hardware_concurrency()));
+	}
+	if (argc > 1 && strcmp(argv[1], "--epoch-report") == 0)
+	{
+		unsigned int thread_count = argc > 2 ? (unsigned int)std::strtoul(argv[2], nullptr, 10) : 0;
+		return report_epochs(thread_count ? thread_count : std::max(1u, std::thread::hardware_concurrency()));
+	}
+	if (argc > 1 && strcmp(argv[1], "--fast-math-report") == 0)
+	{
+		return report_fast_math(argc > 2 ? (unsigned int)std::strtoul(argv[2], nullptr, 10) : ITERATIONS_PER_PIXEL);
+	}
+
+	std::string input_file_name = argc > 1 ? argv[1] : EROSION_TEST_DATA_DIR "/heightmap_512.png";
+	uint64_t droplet_count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0;
+	return benchmark_kernels(input_file_name, droplet_count);
+}
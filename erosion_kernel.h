@@ -0,0 +1,629 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "erosion_params.h"
+#include "fast_math.h"
+#include "fixed_point.h"
+#include "heightmap.h"
+#include "rng.h"
+
+// Forces the per-step helpers inline: with one instantiation of the kernel per KernelVariant the translation units
+// grow past the inliner's budget, and a call per step costs more than the helpers themselves
+#if defined(__GNUC__)
+#define EROSION_INLINE inline __attribute__((always_inline))
+#else
+#define EROSION_INLINE inline
+#endif
+
+// The state of a single droplet, kept outside of erosion_step so that a droplet can be suspended and resumed on another thread
+struct Droplet
+{
+	std::pair<unsigned int, unsigned int> point;
+	CounterRng rng;				// Keyed by the droplet index, counters 0 and 1 pick the spawn point
+	unsigned int step = 0;		// Iteration i draws its random direction from counters 2 + 2i and 3 + 2i
+	float carried_soil = 0.0f;
+	float velocity = 0.0f;
+	unsigned int skipped_steps = 0;	// Iterations left to live when the droplet stalled, see droplet_iteration
+};
+
+// The runtime parameters of the kernels, derived once per run from the ErosionParams and the size of the map
+// Kept by value in the engines, so that the compiler can hold them in registers across the heightmap writes
+struct KernelConstants
+{
+	float tangent_scale_vertical;		// height / scale_vertical
+	float tangent_scale_horizontal;		// width / scale_horizontal
+	float resolution_vertical;			// scale_vertical / height, the size of a cell
+	float resolution_horizontal;		// scale_horizontal / width
+	float rain_detachment;				// s_dr * intensity^2, does not depend on the droplet
+	float s_df;
+	float s_tf;
+	float s_tr;
+	float intensity;
+	float gravity;
+	float friction;
+	unsigned int lifetime;
+
+	KernelConstants(const ErosionParams& params, unsigned int width, unsigned int height)
+		: tangent_scale_vertical((float)height / params.scale_vertical)
+		, tangent_scale_horizontal((float)width / params.scale_horizontal)
+		, resolution_vertical(params.scale_vertical / (float)height)
+		, resolution_horizontal(params.scale_horizontal / (float)width)
+		, rain_detachment(params.s_dr * (params.intensity * params.intensity))
+		, s_df(params.s_df), s_tf(params.s_tf), s_tr(params.s_tr), intensity(params.intensity)
+		, gravity(params.gravity), friction(params.friction)
+		, lifetime(params.lifetime())
+	{}
+};
+
+// The compile-time part of the kernel configuration: the choices that would otherwise branch on every step
+template <PowerMode PowerModeValue, bool SoftBrushValue, unsigned int LifetimeValue>
+struct KernelVariant
+{
+	static constexpr PowerMode power_mode = PowerModeValue;
+	static constexpr bool soft_brush = SoftBrushValue;
+	static constexpr unsigned int lifetime = LifetimeValue;	// 0 when only known at runtime, see KernelConstants::lifetime
+
+	static unsigned int get_lifetime(const KernelConstants& constants) { return lifetime ? lifetime : constants.lifetime; }
+};
+
+// Lifetime of a droplet with the default parameters, which gets its own specialization
+constexpr unsigned int DEFAULT_LIFETIME = droplet_lifetime(STARTING_WATER, EVAPORATION);
+
+// Calls function.template operator()<Variant>() with the KernelVariant matching the parameters, e.g. with a lambda
+// [&]<typename Variant>() { ... }
+template <PowerMode Power, bool SoftBrush, typename Function>
+decltype(auto) dispatch_kernel_lifetime(const ErosionParams& params, Function&& function)
+{
+	if (params.lifetime() == DEFAULT_LIFETIME)
+	{
+		return function.template operator()<KernelVariant<Power, SoftBrush, DEFAULT_LIFETIME>>();
+	}
+	return function.template operator()<KernelVariant<Power, SoftBrush, 0>>();
+}
+
+template <PowerMode Power, typename Function>
+decltype(auto) dispatch_kernel_brush(const ErosionParams& params, Function&& function)
+{
+	if (params.soft_brush)
+	{
+		return dispatch_kernel_lifetime<Power, true>(params, function);
+	}
+	return dispatch_kernel_lifetime<Power, false>(params, function);
+}
+
+template <typename Function>
+decltype(auto) dispatch_kernel(const ErosionParams& params, Function&& function)
+{
+	if (params.power_mode == PowerMode::Fast)
+	{
+		return dispatch_kernel_brush<PowerMode::Fast>(params, function);
+	}
+	return dispatch_kernel_brush<PowerMode::Exact>(params, function);
+}
+
+// Flow-dependent terms of the detachment and of the transport capacity:
+// s_df * slope^(2/3) * velocity^(2/3) and s_tf * slope^(5/3) * velocity^(5/3)
+template <PowerMode Mode>
+EROSION_INLINE std::pair<float, float> flow_terms(float slope, float velocity, const KernelConstants& constants)
+{
+	if constexpr (Mode == PowerMode::Fast)
+	{
+		float flow = slope * velocity;
+		float flow_2_3 = fast_pow_2_3(flow);
+		return std::make_pair(constants.s_df * flow_2_3, constants.s_tf * (flow * flow_2_3));
+	}
+	else
+	{
+		return std::make_pair(constants.s_df * std::pow(slope, 2.0f / 3.0f) * std::pow(velocity, 2.0f / 3.0f), constants.s_tf * std::pow(slope, 5.0f / 3.0f) * std::pow(velocity, 5.0f / 3.0f));
+	}
+}
+
+// Creates the droplet with the given index, at a random point of the given area (bounds inclusive)
+inline Droplet spawn_droplet(uint64_t seed, uint64_t index, unsigned int row_min, unsigned int row_max, unsigned int col_min, unsigned int col_max)
+{
+	CounterRng rng(seed, index);
+	return Droplet{ std::make_pair(rng.uniform_uint(0, row_min, row_max), rng.uniform_uint(1, col_min, col_max)), rng };
+}
+
+// Gets the tanget at the given point, the ghost border of the heightmap provides the padding at the edges
+EROSION_INLINE std::pair<float, float> get_tangent(const Heightmap& heights, std::pair<unsigned int, unsigned int> point, const KernelConstants& constants)
+{
+	const float* center = heights.row(point.first) + point.second;
+	float bottom = center[heights.stride()];
+	float right = center[1];
+	float left = center[-1];
+	float top = center[-(ptrdiff_t)heights.stride()];
+
+	return std::make_pair((bottom - top) * constants.tangent_scale_vertical, (right - left) * constants.tangent_scale_horizontal);
+}
+
+// Adds value to the given point, and a fraction of it to the 8 neighbours with the soft brush
+// Neighbours outside of the map fall into the ghost border of the heightmap
+template <bool SoftBrush>
+EROSION_INLINE void apply_modification(Heightmap& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	float* center = heights.row(point.first) + point.second;
+	float corner_wieght = 0.15f;
+	float ortho_weight = 0.3f;
+
+	if constexpr (SoftBrush)
+	{
+		float* below = center + heights.stride();
+		float* above = center - heights.stride();
+
+		below[-1] += value * corner_wieght;
+		below[0] += value * ortho_weight;
+		below[1] += value * corner_wieght;
+		above[-1] += value * corner_wieght;
+		above[0] += value * ortho_weight;
+		above[1] += value * corner_wieght;
+		center[-1] += value * ortho_weight;
+		center[1] += value * ortho_weight;
+	}
+	center[0] += value;
+}
+
+// Adds value to the given point only
+EROSION_INLINE void add_height(Heightmap& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	heights[point] += value;
+}
+
+// Writes of the droplets of an epoch, recorded in order instead of applied so that the heightmap stays frozen, see erode_epochs
+struct HeightDeltas
+{
+	struct Delta
+	{
+		uint32_t row, col;
+		float value;
+		bool brushed;	// Goes through apply_modification, otherwise only the cell itself changes
+	};
+	std::vector<Delta> deltas;
+};
+
+// Applies the recorded writes in the order they were made
+// Modifies: heights
+template <bool SoftBrush, typename Terrain>
+void apply_deltas(Terrain& heights, const HeightDeltas& target)
+{
+	for (const HeightDeltas::Delta& delta : target.deltas)
+	{
+		if (delta.brushed)
+		{
+			apply_modification<SoftBrush>(heights, std::make_pair(delta.row, delta.col), delta.value);
+		}
+		else
+		{
+			add_height(heights, std::make_pair(delta.row, delta.col), delta.value);
+		}
+	}
+}
+
+#define OWN_WRITES_SIDE 32	// Side of the direct-mapped window of OwnWrites, a power of two
+
+// The writes of the running droplet, so that it erodes on top of its own earlier writes like in the sequential simulation
+// Cells are mapped on the low bits of their coordinates: a droplet moves one cell per step, so a write is only evicted
+// once the droplet wanders OWN_WRITES_SIDE cells away, and lost if it then comes back to that cell
+struct OwnWrites
+{
+	struct Slot
+	{
+		uint64_t key;	// Row in the high half, column in the low half
+		uint32_t generation = 0;	// The slot belongs to the current droplet if it matches OwnWrites::generation
+		float value;
+	};
+	Slot slots[OWN_WRITES_SIDE * OWN_WRITES_SIDE];
+	uint32_t generation = 1;
+
+	// Forgets the writes of the previous droplet
+	void reset() { generation++; }
+
+	EROSION_INLINE Slot& slot(uint32_t row, uint32_t col)
+	{
+		return slots[(row % OWN_WRITES_SIDE) * OWN_WRITES_SIDE + col % OWN_WRITES_SIDE];
+	}
+
+	EROSION_INLINE float get(uint32_t row, uint32_t col) const
+	{
+		const Slot& slot = slots[(row % OWN_WRITES_SIDE) * OWN_WRITES_SIDE + col % OWN_WRITES_SIDE];
+		bool owned = slot.generation == generation && slot.key == ((uint64_t)row << 32 | col);
+		return owned ? slot.value : 0.0f;
+	}
+
+	// Branchless, whether a droplet hits its own earlier writes is not predictable
+	EROSION_INLINE void add(uint32_t row, uint32_t col, float value)
+	{
+		Slot& target = slot(row, col);
+		uint64_t key = (uint64_t)row << 32 | col;
+		float previous = target.generation == generation && target.key == key ? target.value : 0.0f;
+		target = Slot{ key, generation, previous + value };
+	}
+};
+
+// What a droplet of an epoch sees: the frozen heightmap plus its own writes, which are also recorded for the epoch barrier
+template <typename Grid>
+struct EpochTerrain
+{
+	const Grid& snapshot;
+	HeightDeltas& deltas;
+	OwnWrites& own_writes;
+
+	unsigned int width() const { return snapshot.width(); }
+	unsigned int height() const { return snapshot.height(); }
+
+	EROSION_INLINE float at(uint32_t row, uint32_t col) const { return cell_height(snapshot.at(row, col)) + own_writes.get(row, col); }
+	EROSION_INLINE float operator[](std::pair<unsigned int, unsigned int> point) const { return at(point.first, point.second); }
+};
+
+// Terrains other than a plain Heightmap are read one cell at a time through their at()
+template <typename Terrain>
+EROSION_INLINE std::pair<float, float> get_tangent(const Terrain& heights, std::pair<unsigned int, unsigned int> point, const KernelConstants& constants)
+{
+	float bottom = heights.at(point.first + 1, point.second);
+	float right = heights.at(point.first, point.second + 1);
+	float left = heights.at(point.first, point.second - 1);
+	float top = heights.at(point.first - 1, point.second);
+
+	return std::make_pair((bottom - top) * constants.tangent_scale_vertical, (right - left) * constants.tangent_scale_horizontal);
+}
+
+// Same weights and order as apply_modification on a Heightmap, through the add() of cells
+template <bool SoftBrush, typename Cells>
+EROSION_INLINE void add_brush(Cells& cells, std::pair<unsigned int, unsigned int> point, float value)
+{
+	uint32_t row = point.first;
+	uint32_t col = point.second;
+	if constexpr (SoftBrush)
+	{
+		float corner_wieght = 0.15f;
+		float ortho_weight = 0.3f;
+		cells.add(row + 1, col - 1, value * corner_wieght);
+		cells.add(row + 1, col, value * ortho_weight);
+		cells.add(row + 1, col + 1, value * corner_wieght);
+		cells.add(row - 1, col - 1, value * corner_wieght);
+		cells.add(row - 1, col, value * ortho_weight);
+		cells.add(row - 1, col + 1, value * corner_wieght);
+		cells.add(row, col - 1, value * ortho_weight);
+		cells.add(row, col + 1, value * ortho_weight);
+	}
+	cells.add(row, col, value);
+}
+
+template <bool SoftBrush, typename Grid>
+EROSION_INLINE void apply_modification(EpochTerrain<Grid>& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	heights.deltas.deltas.push_back({ point.first, point.second, value, true });
+	add_brush<SoftBrush>(heights.own_writes, point, value);
+}
+
+template <typename Grid>
+EROSION_INLINE void add_height(EpochTerrain<Grid>& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	heights.deltas.deltas.push_back({ point.first, point.second, value, false });
+	heights.own_writes.add(point.first, point.second, value);
+}
+
+// The heightmap shared by every thread of erode_atomic, each cell is read and written through std::atomic_ref
+// One AtomicTerrain per thread, so that the counters are not shared
+template <typename Grid>
+struct AtomicTerrain
+{
+	using Cell = typename Grid::Cell;
+
+	Grid& heights;
+	uint64_t updates = 0;			// Cells written
+	uint64_t contended_updates = 0;	// Writes retried because another thread changed the cell between the read and the write
+
+	unsigned int width() const { return heights.width(); }
+	unsigned int height() const { return heights.height(); }
+
+	EROSION_INLINE float at(uint32_t row, uint32_t col) const { return cell_height(std::atomic_ref<Cell>(heights.at(row, col)).load(std::memory_order_relaxed)); }
+	EROSION_INLINE float operator[](std::pair<unsigned int, unsigned int> point) const { return at(point.first, point.second); }
+
+	// Floats go through a compare-and-swap loop rather than fetch_add, so that every retry can be counted
+	// Fixed-point cells use an integer fetch_add, which never retries
+	EROSION_INLINE void add(uint32_t row, uint32_t col, float value)
+	{
+		std::atomic_ref<Cell> cell(heights.at(row, col));
+		if constexpr (std::is_same_v<Cell, float>)
+		{
+			float expected = cell.load(std::memory_order_relaxed);
+			while (!cell.compare_exchange_strong(expected, expected + value, std::memory_order_relaxed))
+			{
+				contended_updates++;
+			}
+		}
+		else
+		{
+			cell.fetch_add(to_fixed(value), std::memory_order_relaxed);
+		}
+		updates++;
+	}
+};
+
+template <bool SoftBrush, typename Grid>
+EROSION_INLINE void apply_modification(AtomicTerrain<Grid>& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	add_brush<SoftBrush>(heights, point, value);
+}
+
+template <typename Grid>
+EROSION_INLINE void add_height(AtomicTerrain<Grid>& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	heights.add(point.first, point.second, value);
+}
+
+// Any fixed-point heightmap, as the kernel sees it: cells are reached through at(), which
+// follows the layout of the grid, the physics stays in float levels, and every write is rounded to the cell type
+template <typename Grid>
+struct CellTerrain
+{
+	Grid& heights;
+
+	unsigned int width() const { return heights.width(); }
+	unsigned int height() const { return heights.height(); }
+
+	EROSION_INLINE float at(uint32_t row, uint32_t col) const { return cell_height(heights.at(row, col)); }
+	EROSION_INLINE float operator[](std::pair<unsigned int, unsigned int> point) const { return at(point.first, point.second); }
+
+	EROSION_INLINE void add(uint32_t row, uint32_t col, float value) { heights.at(row, col) += to_cell<typename Grid::Cell>(value); }
+};
+
+template <bool SoftBrush, typename Grid>
+EROSION_INLINE void apply_modification(CellTerrain<Grid>& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	add_brush<SoftBrush>(heights, point, value);
+}
+
+template <typename Grid>
+EROSION_INLINE void add_height(CellTerrain<Grid>& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	heights.add(point.first, point.second, value);
+}
+
+// A blocked float heightmap locates the center cell once and steps to its neighbours by the offsets of its block edges
+template <size_t Side>
+EROSION_INLINE std::pair<float, float> get_tangent(BasicBlockedHeightmap<Side>& heights, std::pair<unsigned int, unsigned int> point, const KernelConstants& constants)
+{
+	typename BasicBlockedHeightmap<Side>::Neighbourhood cells = heights.neighbourhood(point.first, point.second);
+	float bottom = cells.center[cells.down];
+	float right = cells.center[cells.right];
+	float left = cells.center[cells.left];
+	float top = cells.center[cells.up];
+
+	return std::make_pair((bottom - top) * constants.tangent_scale_vertical, (right - left) * constants.tangent_scale_horizontal);
+}
+
+template <bool SoftBrush, size_t Side>
+EROSION_INLINE void apply_modification(BasicBlockedHeightmap<Side>& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	typename BasicBlockedHeightmap<Side>::Neighbourhood cells = heights.neighbourhood(point.first, point.second);
+	float* center = cells.center;
+	float corner_wieght = 0.15f;
+	float ortho_weight = 0.3f;
+
+	if constexpr (SoftBrush)
+	{
+		float* below = center + cells.down;
+		float* above = center + cells.up;
+
+		below[cells.left] += value * corner_wieght;
+		below[0] += value * ortho_weight;
+		below[cells.right] += value * corner_wieght;
+		above[cells.left] += value * corner_wieght;
+		above[0] += value * ortho_weight;
+		above[cells.right] += value * corner_wieght;
+		center[cells.left] += value * ortho_weight;
+		center[cells.right] += value * ortho_weight;
+	}
+	center[0] += value;
+}
+
+template <size_t Side>
+EROSION_INLINE void add_height(BasicBlockedHeightmap<Side>& heights, std::pair<unsigned int, unsigned int> point, float value)
+{
+	heights[point] += value;
+}
+
+// The terrain the kernel runs on for each kind of heightmap
+EROSION_INLINE Heightmap& grid_terrain(Heightmap& heights)
+{
+	return heights;
+}
+
+template <size_t Side>
+EROSION_INLINE BasicBlockedHeightmap<Side>& grid_terrain(BasicBlockedHeightmap<Side>& heights)
+{
+	return heights;
+}
+
+template <typename Grid>
+EROSION_INLINE CellTerrain<Grid> grid_terrain(Grid& heights)
+{
+	return CellTerrain<Grid>{ heights };
+}
+
+EROSION_INLINE float get_acceleration(float height_diff, float resolution, const KernelConstants& constants)
+{
+	height_diff = height_diff / 32.0f;
+
+	float accel_friction = constants.gravity * (resolution / std::sqrt(resolution * resolution + height_diff * height_diff)) * constants.friction;
+	float accel_front = constants.gravity * ((height_diff * height_diff) / std::sqrt(resolution * resolution + height_diff * height_diff));
+
+	// Multiply by resolution since force is applied for the 'duration' of the resolution square
+	return (accel_front - accel_friction) * resolution;
+}
+
+// Whether the point is lower than its four neighbours, which all lie on the map, so that a droplet there steps uphill
+// whichever random direction it picks
+template <typename Terrain>
+EROSION_INLINE bool is_pit(const Terrain& heights, std::pair<unsigned int, unsigned int> point)
+{
+	unsigned int row = point.first;
+	unsigned int col = point.second;
+	if (row == 0 || col == 0 || row + 1 >= heights.height() || col + 1 >= heights.width())
+	{
+		return false;
+	}
+	float center = heights.at(row, col);
+	return center < heights.at(row - 1, col) && center < heights.at(row + 1, col) && center < heights.at(row, col - 1) && center < heights.at(row, col + 1);
+}
+
+// Advances the droplet by a single iteration
+// Terrain is a Heightmap, a BlockedHeightmap or a CellTerrain, where every droplet sees the writes of the previous ones, or the
+// EpochTerrain or AtomicTerrain of a parallel engine
+// A droplet that carries no soil and meets an uphill step deposits nothing and stays where it is. Unless it picked a random
+// direction on flat ground, or sits in a pit, the next iteration then repeats this one exactly, so the droplet is stopped
+// there and the iterations it had left are counted in skipped_steps. Nothing else writes to the cells a droplet reads while
+// it runs, so the heightmap is the same as if it had spun until it evaporated; only the atomic engine, where other threads
+// may fill the pit meanwhile, drifts.
+// Returns false once the droplet has evaporated, left the simulation bounds or stalled
+// Modifies: heights
+template <typename Variant, typename Terrain>
+bool droplet_iteration(Terrain& heights, Droplet& droplet, const KernelConstants& constants)
+{
+	unsigned int width = heights.width();
+	unsigned int height = heights.height();
+	auto& point = droplet.point;
+	uint64_t counter = 2 + 2 * (uint64_t)droplet.step++;
+
+	// Get the tangent at the current point
+	std::pair<float, float> direction = get_tangent(heights, point, constants);
+
+	// If tangent is close to 0, choose random direction
+	bool random_direction = std::abs(direction.first) <= constants.resolution_vertical && std::abs(direction.second) <= constants.resolution_horizontal;
+	if (random_direction)
+	{
+		direction.first = droplet.rng.uniform_float(counter, -1.0f, 1.0f);
+		direction.second = droplet.rng.uniform_float(counter + 1, -1.0f, 1.0f);
+	}
+
+	float slope;
+	auto next_point = point;
+	// based on direction, choose next point and compute slope
+	if (std::abs(direction.first) > std::abs(direction.second))
+	{
+		if (direction.first > 0.0f) // the slope is pointing to the north
+		{
+			next_point.first -= 1;
+		}
+		else
+		{
+			next_point.first += 1;
+		}
+		slope = std::abs(direction.first);
+	}
+	else
+	{
+		if (direction.second > 0.0f) // the slope is pointing to the west
+		{
+			next_point.second -= 1;
+		}
+		else
+		{
+			next_point.second += 1;
+		}
+		slope = std::abs(direction.second);
+	}
+	if (next_point.first >= height || next_point.second >= width)
+	{
+		return false; // The droplet has left the simulation bounds
+	}
+
+	// Perform erosion or deposition
+	float d_r = constants.rain_detachment;
+	auto [d_f, t_f] = flow_terms<Variant::power_mode>(slope, droplet.velocity, constants);
+	float t_r = constants.s_tr * slope * constants.intensity;
+
+	float detached_soil = d_r + d_f;
+	float transport_capacity = t_r + t_f;
+
+	auto height_diff = heights[point] - heights[next_point];
+
+	// It does not make sense for the next point to be at a higher position than our current point
+	if (height_diff < 0.0f)
+	{
+		float deposited;
+		if (droplet.carried_soil < -height_diff / 2.8f)
+		{
+			deposited = droplet.carried_soil;
+		}
+		else
+		{
+			deposited = -height_diff;
+		}
+		droplet.carried_soil -= deposited;
+		apply_modification<Variant::soft_brush>(heights, point, deposited * 0.75f);
+		add_height(heights, point, deposited * 2.8f * 0.25f);
+
+		droplet.velocity = 0.0f;
+		// We do NOT update the point location, it could be permanently stuck
+		if (deposited == 0.0f && (!random_direction || is_pit(heights, point)))
+		{
+			// Stalled: the droplet carries nothing and changed nothing, so every iteration left reads the same cells,
+			// steps uphill again and deposits nothing until it evaporates
+			droplet.skipped_steps = Variant::get_lifetime(constants) - droplet.step;
+			return false;
+		}
+	}
+	else
+	{
+		apply_modification<Variant::soft_brush>(heights, point, -detached_soil);
+		droplet.carried_soil += detached_soil;
+
+		float sedimented_soil = std::max(droplet.carried_soil - transport_capacity, 0.0f);
+
+		if (sedimented_soil > 0.1f)
+		{
+			apply_modification<Variant::soft_brush>(heights, point, sedimented_soil);
+			droplet.carried_soil -= sedimented_soil;
+		}
+
+		droplet.velocity += get_acceleration(height_diff, constants.resolution_vertical, constants);
+		// For numerical stability, velocity cannot be lower than 0 or higher than 32
+		droplet.velocity = std::clamp(droplet.velocity, 0.0f, 32.0f);
+		point = next_point;
+	}
+
+	// The water evaporates at a constant rate, so the droplet dies after a fixed number of iterations
+	return droplet.step < Variant::get_lifetime(constants);
+}
+
+// Iterations of the droplets of a run
+struct DropletSteps
+{
+	uint64_t steps = 0;			// Iterations simulated
+	uint64_t skipped_steps = 0;	// Iterations that stalled droplets did not simulate, see droplet_iteration
+
+	void add(const Droplet& droplet)
+	{
+		steps += droplet.step;
+		skipped_steps += droplet.skipped_steps;
+	}
+
+	DropletSteps& operator+=(const DropletSteps& other)
+	{
+		steps += other.steps;
+		skipped_steps += other.skipped_steps;
+		return *this;
+	}
+};
+
+// Performs one erosion step by simulating the erosion of one 'droplet'
+// Returns the number of iterations the droplet lived for, and skipped if it stalled
+// Modifies: heights
+template <typename Variant, typename Terrain>
+DropletSteps erosion_step(Terrain& heights, Droplet droplet, KernelConstants constants)
+{
+	while (droplet_iteration<Variant>(heights, droplet, constants));
+	DropletSteps steps;
+	steps.add(droplet);
+	return steps;
+}
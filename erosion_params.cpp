@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+
+#include "erosion_params.h"
+
+// Parses the whole string as a value of type T, returns false on trailing characters or a missing value
+template <typename T>
+static bool parse_value(const std::string& text, T& value)
+{
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+	return error == std::errc() && end == text.data() + text.size();
+}
+
+static bool parse_value(const std::string& text, bool& value)
+{
+	if (text == "1" || text == "true" || text == "on")
+	{
+		value = true;
+		return true;
+	}
+	if (text == "0" || text == "false" || text == "off")
+	{
+		value = false;
+		return true;
+	}
+	return false;
+}
+
+bool ErosionParams::set(const std::string& name, const std::string& value)
+{
+	// Positive floats, the simulation divides by or loops on every one of them
+	float* positive = name == "evaporation" ? &evaporation
+		: name == "starting_water" ? &starting_water
+		: name == "scale_vertical" ? &scale_vertical
+		: name == "scale_horizontal" ? &scale_horizontal
+		: nullptr;
+	float* non_negative = name == "intensity" ? &intensity
+		: name == "s_dr" ? &s_dr
+		: name == "s_df" ? &s_df
+		: name == "s_tf" ? &s_tf
+		: name == "s_tr" ? &s_tr
+		: name == "friction" ? &friction
+		: name == "gravity" ? &gravity
+		: nullptr;
+
+	float number;
+	if (positive)
+	{
+		if (!parse_value(value, number) || !(number > 0.0f))
+		{
+			return false;
+		}
+		*positive = number;
+		return true;
+	}
+	if (non_negative)
+	{
+		if (!parse_value(value, number) || !(number >= 0.0f))
+		{
+			return false;
+		}
+		*non_negative = number;
+		return true;
+	}
+
+	if (name == "soft_brush")
+	{
+		return parse_value(value, soft_brush);
+	}
+	if (name == "fixed_point")
+	{
+		return parse_value(value, fixed_point);
+	}
+	if (name == "blocked_layout")
+	{
+		return parse_value(value, blocked_layout);
+	}
+	if (name == "fast_math")
+	{
+		bool fast;
+		if (!parse_value(value, fast))
+		{
+			return false;
+		}
+		power_mode = fast ? PowerMode::Fast : PowerMode::Exact;
+		return true;
+	}
+	if (name == "droplets_per_pixel")
+	{
+		return parse_value(value, droplets_per_pixel);
+	}
+	if (name == "rng_margins")
+	{
+		return parse_value(value, rng_margins);
+	}
+	if (name == "epoch_size")
+	{
+		unsigned int size;
+		if (!parse_value(value, size) || size == 0)
+		{
+			return false;
+		}
+		epoch_size = size;
+		return true;
+	}
+	if (name == "seed")
+	{
+		return parse_value(value, seed);
+	}
+	if (name == "pyramid_droplets")
+	{
+		std::vector<unsigned int> levels;
+		for (size_t begin = 0; value != "off" && begin <= value.size();)
+		{
+			size_t end = std::min(value.find(',', begin), value.size());
+			unsigned int droplets;
+			if (!parse_value(value.substr(begin, end - begin), droplets))
+			{
+				return false;
+			}
+			levels.push_back(droplets);
+			begin = end + 1;
+		}
+		pyramid_droplets = levels;
+		return true;
+	}
+	return false;
+}
+
+bool ErosionParams::load(const std::string& file_name, std::string& error)
+{
+	std::ifstream file(file_name);
+	if (!file)
+	{
+		error = "cannot open " + file_name;
+		return false;
+	}
+
+	auto trim = [](const std::string& text)
+	{
+		size_t begin = text.find_first_not_of(" \t\r");
+		size_t end = text.find_last_not_of(" \t\r");
+		return begin == std::string::npos ? std::string() : text.substr(begin, end - begin + 1);
+	};
+
+	std::string line;
+	for (unsigned int line_number = 1; std::getline(file, line); line_number++)
+	{
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty())
+		{
+			continue;
+		}
+
+		size_t separator = line.find('=');
+		if (separator == std::string::npos || !set(trim(line.substr(0, separator)), trim(line.substr(separator + 1))))
+		{
+			error = file_name + ":" + std::to_string(line_number) + ": invalid parameter line '" + line + "'";
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Default values of the ErosionParams
+#define RNG_MARGINS 1		// The number of pixels the droplet placement should be distanced from the edges of the image, at minimum
+#define RNG_SEED 0			// Default seed, constant for testing purposes
+
+#define ITERATIONS 1000000
+#define ITERATIONS_PER_PIXEL 10
+#define EVAPORATION 0.002f
+#define INTENSITY 3.5f
+#define S_DR 0.01f
+#define S_DF 0.0005f
+#define S_TF 0.0001f
+#define S_TR 0.01f
+#define STARTING_WATER 1.0f
+#define FRICTION_COEFF 0.3f
+#define GRAVITATIONAL_CONST 9.8f
+
+// Scales are defined in kilometers
+#define SIMULATION_SCALE_VERTICAL 32.0f
+#define SIMULATION_SCALE_HORIZONTAL 32.0f
+
+#define SOFT_BRUSH true
+#define FIXED_POINT false	// Erode an int32 fixed-point heightmap instead of floats, see fixed_point.h
+#define BLOCKED_LAYOUT false	// Erode a heightmap stored in 8x8 blocks instead of rows, see BlockedLayout
+
+#define EPOCH_SIZE 1024		// Droplets that read the same frozen heightmap in ErosionEngine::Epochs
+
+// Selects how the 2/3 and 5/3 power terms of the transport equations are evaluated
+enum class PowerMode
+{
+	Exact,	// std::pow, the reference
+	Fast,	// One Newton-refined cube root shared by both terms, relative error below FAST_POW_MAX_RELATIVE_ERROR
+};
+
+// Number of iterations a droplet lives for, by repeating the subtraction of the evaporation until no water is left
+constexpr unsigned int droplet_lifetime(float starting_water, float evaporation)
+{
+	unsigned int iterations = 0;
+	for (float water = starting_water; water > 0.0f; water -= evaporation)
+	{
+		iterations++;
+	}
+	return iterations;
+}
+
+// Every tuning knob of the simulation, settable from the command line or from a config file
+struct ErosionParams
+{
+	float evaporation = EVAPORATION;
+	float intensity = INTENSITY;
+	float s_dr = S_DR;
+	float s_df = S_DF;
+	float s_tf = S_TF;
+	float s_tr = S_TR;
+	float starting_water = STARTING_WATER;
+	float friction = FRICTION_COEFF;
+	float gravity = GRAVITATIONAL_CONST;
+	float scale_vertical = SIMULATION_SCALE_VERTICAL;
+	float scale_horizontal = SIMULATION_SCALE_HORIZONTAL;
+	bool soft_brush = SOFT_BRUSH;
+	PowerMode power_mode = PowerMode::Exact;
+	unsigned int droplets_per_pixel = ITERATIONS_PER_PIXEL;
+	unsigned int rng_margins = RNG_MARGINS;
+	uint64_t seed = RNG_SEED;
+	unsigned int epoch_size = EPOCH_SIZE;
+	bool fixed_point = FIXED_POINT;
+	bool blocked_layout = BLOCKED_LAYOUT;
+	// Droplets per pixel of the coarse levels of the pyramid, half resolution first, empty for a single level, see
+	// erode_heightmap. Set as a comma-separated list, e.g. "8,16", or "off"
+	std::vector<unsigned int> pyramid_droplets;
+
+	unsigned int lifetime() const { return droplet_lifetime(starting_water, evaporation); }
+
+	// Sets the parameter with the given name from its text value, e.g. set("evaporation", "0.004")
+	// Returns false, and leaves the parameters unchanged, if the name is unknown or the value is invalid
+	bool set(const std::string& name, const std::string& value);
+
+	// Reads "name = value" lines, '#' starts a comment
+	// Returns false and describes the first problem in error if the file cannot be read or has an invalid line
+	bool load(const std::string& file_name, std::string& error);
+};
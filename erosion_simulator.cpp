@@ -2,298 +2,212 @@
 #include <vector>
 #include <string>
 #include <chrono>
-#include <random>
+#include <algorithm>
+#include <cstring>
+#include <thread>
 
-#include "lodepng.h"
+#include "image_job.h"
 
-#define RNG_MARGINS 1		// The number of pixels the droplet placement should be distanced from the edges of the image, at minimum
-
-#define ITERATIONS 1000000
-#define ITERATIONS_PER_PIXEL 10
-#define EVAPORATION 0.002f
-#define INTENSITY 3.5f
-#define S_DR 0.01f
-#define S_DF 0.0005f
-#define S_TF 0.0001f
-#define S_TR 0.01f
-#define STARTING_WATER 1.0f
-#define FRICTION_COEFF 0.3f
-#define GRAVITATIONAL_CONST 9.8f
-
-// Scales are defined in kilometers
-#define SIMULATION_SCALE_VERTICAL 32.0f 
-#define SIMULATION_SCALE_HORIZONTAL 32.0f 
-
-#define SOFT_BRUSH true
-
-// Gets the tanget at the given point, with padding at the edges by copying the point's height
-std::pair<float, float> get_tangent(float** heights, unsigned int width, unsigned int height, std::pair<unsigned int, unsigned int> point)
-{
-	float bottom = point.first < height - 1 ? heights[point.first + 1][point.second] : heights[point.first][point.second];
-	float right = point.second < width - 1 ? heights[point.first][point.second + 1] : heights[point.first][point.second];
-	float left = point.second > 0 ? heights[point.first][point.second - 1] : heights[point.first][point.second];
-	float top = point.first > 0 ? heights[point.first - 1][point.second] : heights[point.first][point.second];
-
-	return std::make_pair((bottom - top) * ((float)height / SIMULATION_SCALE_VERTICAL), (right - left) * ((float)width / SIMULATION_SCALE_HORIZONTAL));
-}
-
-void apply_modification(float** heights, unsigned int width, unsigned int height, std::pair<unsigned int, unsigned int> point, float value)
+int main(int argc, char **argv)
 {
-	unsigned int x = point.first;
-	unsigned int y = point.second;
-	float corner_wieght = 0.15f;
-	float ortho_weight = 0.3f;
-
-#if SOFT_BRUSH
-	if (x + 1 < height)
+	// Usage: erosion_sim <input.png> <output.png> [<input.png> <output.png>]... [--manifest FILE] [--jobs N] [--queue-capacity N]
+	//                    [--output-depth 8|16] [--png-preset store|fast|default|max] [--ehm-format tiles|rows|uint16]
+	//                    [--threads N | --batch | --epochs [--threads N] | --atomic [--threads N]] [--seed S] [--fast-math] [--config FILE] [--<parameter> VALUE]...
+	//                    [--checkpoint-interval SECONDS] [--stop-after SECONDS] [--resume]
+	// Several input/output pairs, or a --manifest of "input output" lines, are processed in one run by a pool of --jobs
+	// worker threads (every hardware thread by default), followed by a per-file timing summary
+	// Decoding and encoding run on their own threads, --queue-capacity N bounds the files waiting between the stages
+	// Outputs are greyscale PNGs of --output-depth 8 or 16 bits, --png-preset store, fast, default or max trades encode
+	// time for file size
+	// Files ending in .ehm are mapped heightmaps, see mapped_heightmap.h, written in the --ehm-format of the .ehm input or
+	// tiles by default. An .ehm input with an .ehm output of the same float format is eroded in place: tiled files out of
+	// core on the tiled engine, whatever the engine options, row-major files by the selected engine. Uint16 files convert
+	// through memory, and --droplets-per-pixel 0 converts between formats
+	// --threads selects the tiled multithreaded engine, N = 0 uses every hardware thread
+	// --batch selects the single-threaded SIMD batch kernel
+	// --epochs selects the bulk-synchronous epoch engine, --epoch-size N droplets read each frozen heightmap
+	// --atomic selects the engine where every thread runs droplets over the whole heightmap with atomic cell updates
+	// --checkpoint-interval saves the progress of every job to <output>.ckpt every SECONDS (60 by default with --resume),
+	// --resume continues the jobs from their checkpoints and --stop-after stops them at their first checkpoint after SECONDS.
+	// Only the sequential and the epoch engines take checkpoints, a resumed run writes the same output as one that never stopped
+	// --pyramid-droplets erodes coarser copies of the map first, e.g. --pyramid-droplets 8,16 runs 16 droplets per pixel at a
+	// quarter and 8 at half resolution before the --droplets-per-pixel at full resolution, see erode_heightmap
+	// --fast-math approximates the power terms of the transport equations, see fast_math.h for the error bound
+	// --config reads "name = value" lines, see ErosionParams; options after it override the file
+	// --<parameter> sets any other ErosionParams field by name, dashes may replace the underscores (e.g. --starting-water 2)
+	std::vector<char*> positional;
+	ErosionEngine engine = ErosionEngine::Sequential;
+	ErosionParams params;
+	unsigned int thread_count = 0;
+	unsigned int job_count = 0;
+	size_t queue_capacity = 0;
+	PngOutputOptions output;
+	std::optional<MappedFormat> mapped_format;
+	bool checkpoints = false;
+	CheckpointSettings checkpoint;
+	std::vector<ImageJob> jobs;
+	bool batch_run = false;
+	for (int i = 1; i < argc; i++)
 	{
-		if (y > 0)
+		if (strcmp(argv[i], "--fast-math") == 0)
 		{
-			heights[x + 1][y - 1] += value * corner_wieght;
+			params.power_mode = PowerMode::Fast;
 		}
-		heights[x + 1][y] += value * ortho_weight;
-		if (y + 1 < width)
+		else if (strcmp(argv[i], "--batch") == 0)
 		{
-			heights[x + 1][y + 1] += value * corner_wieght;
+			engine = ErosionEngine::Batched;
 		}
-	}
-	if (x > 0)
-	{
-		if (y > 0)
-		{
-			heights[x - 1][y - 1] += value * corner_wieght;
-		}
-		heights[x - 1][y] += value * ortho_weight;
-		if (y + 1 < width)
+		else if (strcmp(argv[i], "--epochs") == 0)
 		{
-			heights[x - 1][y + 1] += value * corner_wieght;
+			engine = ErosionEngine::Epochs;
 		}
-	}
-	if (y > 0)
-	{
-		heights[x][y - 1] += value * ortho_weight;
-	}
-	if (y + 1 < width)
-	{
-		heights[x][y + 1] += value * ortho_weight;
-	}
-#endif
-	heights[x][y] += value;
-}
-
-float get_acceleration(float height_diff, float resolution)
-{
-	height_diff = height_diff / 32.0f;
-
-	float accel_friction = GRAVITATIONAL_CONST * (resolution / std::sqrt(resolution * resolution + height_diff * height_diff)) * FRICTION_COEFF;
-	float accel_front = GRAVITATIONAL_CONST * ((height_diff * height_diff) / std::sqrt(resolution * resolution + height_diff * height_diff));
-	
-	// Multiply by resolution since force is applied for the 'duration' of the resolution square
-	return (accel_front - accel_friction) * resolution;
-}
-
-// Performs one erosion step by simulating the erosion of one 'droplet'
-// Modifies: float** heights
-void erosion_step(float** heights, unsigned int width, unsigned int height, std::pair<unsigned int, unsigned int> point)
-{
-	float water_amount = STARTING_WATER;
-	float carried_soil = 0.0f;
-	float velocity = 0.0f;
-	std::pair<float, float> direction {0.0f, 0.0f};
-	
-	std::uniform_real_distribution random_float(-1.0f, 1.0f);
-	std::mt19937 gen(0);
-
-	auto next_point = point;
-	while (water_amount > 0.0f)
-	{
-		// Get the tangent at the current point
-		direction = get_tangent(heights, width, height, point);
-
-		// If tangent is close to 0, choose random direction
-		if (std::abs(direction.first) <= (SIMULATION_SCALE_VERTICAL / (float)height) && std::abs(direction.second) <= (SIMULATION_SCALE_HORIZONTAL / (float)width))
+		else if (strcmp(argv[i], "--atomic") == 0)
 		{
-			direction.first = random_float(gen);
-			direction.second = random_float(gen);
+			engine = ErosionEngine::Atomic;
 		}
-
-		float slope;
-		// based on direction, choose next point and compute slope
-		if (std::abs(direction.first) > std::abs(direction.second))
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
 		{
-			if (direction.first > 0.0f) // the slope is pointing to the north
+			// Selects the tiled engine unless another multithreaded engine was asked for
+			if (engine != ErosionEngine::Epochs && engine != ErosionEngine::Atomic)
 			{
-				next_point.first -= 1;
+				engine = ErosionEngine::Tiled;
 			}
-			else
+			thread_count = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+		{
+			job_count = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--output-depth") == 0 && i + 1 < argc)
+		{
+			output.bit_depth = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+			if (output.bit_depth != 8 && output.bit_depth != 16)
 			{
-				next_point.first += 1;
+				std::cout << "Invalid option --output-depth " << argv[i] << ", expected 8 or 16" << std::endl;
+				return 1;
 			}
-			slope = std::abs(direction.first);
 		}
-		else
+		else if (strcmp(argv[i], "--png-preset") == 0 && i + 1 < argc)
 		{
-			if (direction.second > 0.0f) // the slope is pointing to the west
+			if (!parse_png_preset(argv[++i], output.preset))
 			{
-				next_point.second -= 1;
+				std::cout << "Invalid option --png-preset " << argv[i] << ", expected store, fast, default or max" << std::endl;
+				return 1;
 			}
-			else
+		}
+		else if (strcmp(argv[i], "--ehm-format") == 0 && i + 1 < argc)
+		{
+			MappedFormat format;
+			if (!parse_mapped_format(argv[++i], format))
 			{
-				next_point.second += 1;
+				std::cout << "Invalid option --ehm-format " << argv[i] << ", expected tiles, rows or uint16" << std::endl;
+				return 1;
 			}
-			slope = std::abs(direction.second);
+			mapped_format = format;
 		}
-		if (next_point.first < 0 || next_point.first >= height || next_point.second < 0 || next_point.second >= width)
+		else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
 		{
-			return; // The droplet has left the simulation bounds
+			checkpoint.interval = std::strtod(argv[++i], nullptr);
+			checkpoints = true;
 		}
-
-		// Perform erosion or deposition
-		float d_r = S_DR * std::pow(INTENSITY, 2.0f);
-		float d_f = S_DF * std::pow(slope, 2.0f / 3.0f) * std::pow(velocity, 2.0f / 3.0f);
-		float t_r = S_TR * slope * INTENSITY;
-		float t_f = S_TF * std::pow(slope, 5.0f / 3.0f) * std::pow(velocity, 5.0f / 3.0f);
-		
-		float detached_soil = d_r + d_f;
-		float transport_capacity = t_r + t_f;
-		
-		auto height_diff = heights[point.first][point.second] - heights[next_point.first][next_point.second];
-		
-		// It does not make sense for the next point to be at a higher position than our current point
-		if (height_diff < 0.0f)
+		else if (strcmp(argv[i], "--stop-after") == 0 && i + 1 < argc)
+		{
+			checkpoint.stop_after = std::strtod(argv[++i], nullptr);
+			checkpoints = true;
+		}
+		else if (strcmp(argv[i], "--resume") == 0)
+		{
+			checkpoint.resume = true;
+			checkpoints = true;
+		}
+		else if (strcmp(argv[i], "--queue-capacity") == 0 && i + 1 < argc)
 		{
-			float deposited;
-			if (carried_soil < -height_diff / 2.8f)
+			queue_capacity = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc)
+		{
+			std::string manifest_error;
+			if (!load_manifest(argv[++i], jobs, manifest_error))
 			{
-				deposited = carried_soil;
+				std::cout << manifest_error << std::endl;
+				return 1;
 			}
-			else
+			batch_run = true;
+		}
+		else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+		{
+			std::string config_error;
+			if (!params.load(argv[++i], config_error))
 			{
-				deposited = -height_diff;
+				std::cout << config_error << std::endl;
+				return 1;
 			}
-			carried_soil -= deposited;
-			apply_modification(heights, width, height, point, deposited * 0.75f);
-			heights[point.first][point.second] += deposited * 2.8f * 0.25f;
-
-			velocity = 0.0f;
-			// We do NOT update the point location, it could be permanently stuck
 		}
-		else
+		else if (strncmp(argv[i], "--", 2) == 0)
 		{
-			apply_modification(heights, width, height, point, -detached_soil);
-			carried_soil += detached_soil;
-
-			float sedimented_soil = std::max(carried_soil - transport_capacity, 0.0f);
-
-			if (sedimented_soil > 0.1f)
+			std::string name = argv[i] + 2;
+			std::replace(name.begin(), name.end(), '-', '_');
+			if (i + 1 >= argc || !params.set(name, argv[i + 1]))
 			{
-				apply_modification(heights, width, height, point, sedimented_soil);
-				carried_soil -= sedimented_soil;
+				std::cout << "Invalid option " << argv[i] << (i + 1 < argc ? std::string(" ") + argv[i + 1] : std::string()) << std::endl;
+				return 1;
 			}
-			
-			velocity += get_acceleration(height_diff, (SIMULATION_SCALE_VERTICAL / (float)height));
-			// For numerical stability, velocity cannot be lower than 0 or higher than 32
-			velocity = std::clamp(velocity, 0.0f, 32.0f);
-			point = next_point;
+			i++;
 		}
-
-		water_amount -= EVAPORATION;
-	}
-}
-
-void erode_image(unsigned char** pixels, unsigned int width, unsigned int height)
-{
-	float** heights = new float* [height];
-	for (int i = 0; i < height; ++i) {
-		heights[i] = new float[width];
-	}
-
-	for (int i = 0; i < height; i++)
-	{
-		for (int j = 0; j < width; j++)
+		else
 		{
-			heights[i][j] = (float) pixels[i][j];
+			positional.push_back(argv[i]);
 		}
 	}
 
-	std::random_device rd;
-	std::mt19937 gen(0);	// Set a constant seed for testing purposes
-	std::uniform_int_distribution<unsigned> distrib_width(RNG_MARGINS, width - RNG_MARGINS);
-	std::uniform_int_distribution<unsigned> distrib_height(RNG_MARGINS, height - RNG_MARGINS);
-
-	for (long long i = 0; i < (width * height) * ITERATIONS_PER_PIXEL; i++)
+	if (positional.size() % 2 != 0 || positional.size() + jobs.size() == 0)
 	{
-		erosion_step(heights, width, height, std::make_pair(distrib_width(gen), distrib_height(gen)));
+		std::cout << "Incorrect number of arguments given! Expected input/output pairs.";
+		return 1;
 	}
-
-	for (int i = 0; i < height; i++)
+	for (size_t i = 0; i < positional.size(); i += 2)
 	{
-		for (int j = 0; j < width; j++)
-		{
-			heights[i][j] = std::clamp(heights[i][j], 0.0f, 255.0f); // To ensure type conversion safety
-			pixels[i][j] = (unsigned char)heights[i][j];
-		}
+		jobs.push_back(ImageJob{ positional[i], positional[i + 1] });
 	}
-}
-
-int main(int argc, char **argv)
-{
-	std::vector<unsigned char> image; // The raw pixels
-	unsigned int width, height;
-
-	if (argc != 3)
+	batch_run = batch_run || jobs.size() > 1;
+	if (thread_count == 0)
 	{
-		std::cout << "Incorrect number of arguments given! Expected 2.";
-		return 1;
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
 	}
-	char input_file_name[256];
-	char output_file_name[256];
-	strncpy(input_file_name, argv[1], 255);
-	input_file_name[255] = '\0';
-	strncpy(output_file_name, argv[2], 255);
-	output_file_name[255] = '\0';
-
-	// Decode
-	unsigned int error = lodepng::decode(image, width, height, input_file_name);
-
-	// If there's an error, display it
-	if (error) {
-		std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
-		return -1;
+	if (job_count == 0)
+	{
+		job_count = std::max(1u, std::thread::hardware_concurrency());
 	}
 
-	// Create a 2D array to store pixel values
-	unsigned char** pixels = new unsigned char* [height];
-	for (int i = 0; i < height; ++i) {
-		pixels[i] = new unsigned char[width];
+	if (checkpoints && engine != ErosionEngine::Sequential && engine != ErosionEngine::Epochs)
+	{
+		std::cout << "Checkpoints need the sequential or the --epochs engine, the others always have droplets in flight" << std::endl;
+		return 1;
 	}
 
-	// Copy pixel values to the array
-	for (long long i = 0; i < height; ++i) {
-		for (long long j = 0; j < width; ++j) {
-			// 4 bytes per pixel (RGBA), we poll the R byte - and assume a greyscale image
-			pixels[i][j] = image[(i * height + j) * 4];
-		}
+	ImageJobSettings settings;
+	settings.params = params;
+	settings.engine = engine;
+	settings.thread_count = thread_count;
+	settings.queue_capacity = queue_capacity;
+	settings.output = output;
+	settings.mapped_format = mapped_format;
+	settings.checkpoints = checkpoints;
+	settings.checkpoint = checkpoint;
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<ImageJobResult> results = run_image_jobs(jobs, settings, job_count);
+	std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start;
+
+	bool succeeded = std::all_of(results.begin(), results.end(), [](const ImageJobResult& result) { return result.succeeded; });
+	if (batch_run)
+	{
+		print_timing_summary(jobs, results, wall_time.count());
 	}
-
-	erode_image(pixels, width, height);
-
-	// Write pixel values to PNG vector (RGBA) bytes
-	for (long long i = 0; i < height; ++i) {
-		for (long long j = 0; j < width; ++j) {
-			// 4 bytes per pixel (RGBA), we are creating a greyscale image
-			image[(i * height + j) * 4] = pixels[i][j];
-			image[(i * height + j) * 4 + 1] = pixels[i][j];
-			image[(i * height + j) * 4 + 2] = pixels[i][j];
-			image[(i * height + j) * 4 + 3] = 255; // Alpha byte
-		}
+	else if (!succeeded)
+	{
+		std::cout << results[0].error << std::endl;
 	}
 
-	// Save PNG to disk
-	error = lodepng::encode(output_file_name, image, width, height);
-
-	// If there's an error, display it
-	if (error) std::cout << "encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
-
-    return 0;
-}
\ No newline at end of file
+	return succeeded ? 0 : -1;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+#define FAST_CBRT_NEWTON_STEPS 2	// Each step roughly squares the relative error: 3e-3, 1.9e-5, 2.3e-7
+
+// Maximum relative error of fast_pow_2_3 and fast_pow_5_3 over [1e-6, 1e6], measured by erosion_bench --fast-math-report
+#define FAST_POW_MAX_RELATIVE_ERROR 1.9e-5f
+
+// Approximates x^(-1/3) for x >= 0, with a bit-level initial guess refined by Newton steps
+// The steps only multiply, so x = 0 yields a large finite value, and x * fast_inverse_cbrt(x) is exactly 0
+inline float fast_inverse_cbrt(float x)
+{
+	float r = std::bit_cast<float>(0x54a2fa8cu - std::bit_cast<uint32_t>(x) / 3);
+	for (int i = 0; i < FAST_CBRT_NEWTON_STEPS; i++)
+	{
+		r = r * (4.0f / 3.0f - x * r * r * r * (1.0f / 3.0f));
+	}
+	return r;
+}
+
+// x^(2/3) for x >= 0
+inline float fast_pow_2_3(float x)
+{
+	return x * fast_inverse_cbrt(x);
+}
+
+// x^(5/3) for x >= 0, derived from the 2/3 power
+inline float fast_pow_5_3(float x)
+{
+	return x * fast_pow_2_3(x);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "heightmap.h"
+
+#define FIXED_POINT_FRACTION_BITS 16	// Heights of +-32768 levels in steps of 1/65536 level, the float ulp between 128 and 256
+#define FIXED_POINT_ONE (1 << FIXED_POINT_FRACTION_BITS)
+
+// Heights as int32 fixed-point levels: adding integers is associative, so the sum of a set of writes does not depend on
+// the order in which they land, and plain integer atomics can accumulate them
+using FixedHeightmap = BasicHeightmap<int32_t>;
+using BlockedFixedHeightmap = BasicHeightmap<int32_t, BlockedLayout>;
+
+// Height of a cell of either kind of heightmap, in levels
+inline float cell_height(float cell)
+{
+	return cell;
+}
+
+inline float cell_height(int32_t cell)
+{
+	return (float)cell * (1.0f / FIXED_POINT_ONE);
+}
+
+// Nearest fixed-point value of height, saturated to the int32 range
+inline int32_t to_fixed(float height)
+{
+	float scaled = std::clamp(height * FIXED_POINT_ONE, -2147483520.0f, 2147483520.0f);
+	return (int32_t)(scaled + std::copysign(0.5f, scaled));
+}
+
+// Value of a cell of the given type for a height
+template <typename Cell>
+Cell to_cell(float height)
+{
+	if constexpr (std::is_same_v<Cell, int32_t>)
+	{
+		return to_fixed(height);
+	}
+	else
+	{
+		return height;
+	}
+}
+
+// Copies the map cells of a heightmap into a heightmap of another cell type or layout, the ghost border is left to
+// refresh_border()
+// Copies the map cells of a heightmap into another one of the same size, converting the cell type and layout
+// Modifies: target
+template <typename Target, typename Source>
+void copy_cells(const Source& source, Target& target)
+{
+	for (unsigned int r = 0; r < source.height(); r++)
+	{
+		for (unsigned int c = 0; c < source.width(); c++)
+		{
+			target.at(r, c) = to_cell<typename Target::Cell>(cell_height(source.at(r, c)));
+		}
+	}
+}
+
+template <typename Target, typename Source>
+Target convert_heightmap(const Source& source)
+{
+	Target target(source.width(), source.height());
+	copy_cells(source, target);
+	return target;
+}
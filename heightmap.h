@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#define HEIGHTMAP_BLOCK_SIDE 8	// Side of the square blocks of BlockedLayout, 8x8 floats are four cache lines
+
+// Cells stored row after row, every row padded to a whole number of cache lines
+// Layouts map the coordinates of a cell, counted from the top-left corner of the ghost border, to its index in the buffer
+struct RowMajorLayout
+{
+	size_t stride;	// Distance in cells between two vertically adjacent cells
+	size_t rows;
+
+	RowMajorLayout(size_t columns, size_t rows, size_t cells_per_line)
+		: stride((columns + cells_per_line - 1) / cells_per_line * cells_per_line), rows(rows)
+	{
+	}
+
+	size_t cell_count() const { return stride * rows; }
+	size_t index(size_t r, size_t c) const { return r * stride + c; }
+};
+
+// Cells stored in square blocks of Side x Side cells, the blocks in row-major order
+// The 3x3 neighbourhood of a droplet usually lies in a single block, and a step north or south moves Side cells through the
+// buffer instead of a whole row, so a droplet wandering over a wide map touches fewer cache lines and pages
+template <size_t Side>
+struct BasicBlockedLayout
+{
+	static constexpr size_t BLOCK_SIDE = Side;
+	static constexpr size_t BLOCK_CELLS = Side * Side;
+
+	size_t blocks_per_row;
+	size_t block_rows;
+
+	BasicBlockedLayout(size_t columns, size_t rows, size_t)
+		: blocks_per_row((columns + Side - 1) / Side)
+		, block_rows((rows + Side - 1) / Side)
+	{
+	}
+
+	size_t cell_count() const { return blocks_per_row * block_rows * BLOCK_CELLS; }
+	size_t index(size_t r, size_t c) const
+	{
+		size_t block = (r / Side) * blocks_per_row + c / Side;
+		return block * BLOCK_CELLS + (r % Side) * Side + c % Side;
+	}
+
+	// The index is a sum of a row term and a column term, so the neighbours of a cell are at fixed offsets that only
+	// depend on whether the cell lies on the edge of its block, and the diagonal offsets are sums of these
+	ptrdiff_t up(size_t r) const
+	{
+		return r % Side == 0 ? (Side - 1) * Side - (ptrdiff_t)(blocks_per_row * BLOCK_CELLS) : -(ptrdiff_t)Side;
+	}
+	ptrdiff_t down(size_t r) const
+	{
+		return r % Side == Side - 1 ? (ptrdiff_t)(blocks_per_row * BLOCK_CELLS) - (Side - 1) * Side : Side;
+	}
+	ptrdiff_t left(size_t c) const
+	{
+		return c % Side == 0 ? (Side - 1) - (ptrdiff_t)BLOCK_CELLS : -1;
+	}
+	ptrdiff_t right(size_t c) const
+	{
+		return c % Side == Side - 1 ? (ptrdiff_t)BLOCK_CELLS - (Side - 1) : 1;
+	}
+};
+
+using BlockedLayout = BasicBlockedLayout<HEIGHTMAP_BLOCK_SIDE>;
+
+// A 2D grid of heights stored in one contiguous, cache-line aligned buffer, of float levels (Heightmap) or of fixed-point
+// levels (FixedHeightmap, see fixed_point.h), in row-major order or in blocks (BlockedHeightmap)
+// Every row is surrounded by a ghost border of BORDER cells, so that the 3x3 kernels of the simulation can read and write
+// the neighbours of any cell on the map without bounds checks. Writes that land in the border are discarded on the next
+// refresh_border(), which also copies the edge cells outwards, so that reads outside the map see the height of the closest edge.
+template <typename CellType, typename LayoutType = RowMajorLayout>
+class BasicHeightmap
+{
+public:
+	using Cell = CellType;
+	using Layout = LayoutType;
+	static constexpr unsigned int BORDER = 1;
+	static constexpr size_t ALIGNMENT = 64;
+	static constexpr bool ROW_MAJOR = std::is_same_v<Layout, RowMajorLayout>;
+
+	BasicHeightmap(unsigned int width, unsigned int height)
+		: m_width(width), m_height(height)
+		, m_layout(width + 2 * BORDER, height + 2 * BORDER, ALIGNMENT / sizeof(Cell))
+		, m_buffer(allocate(m_layout.cell_count()))
+	{
+		std::fill_n(m_buffer.get(), m_layout.cell_count(), Cell{});
+	}
+
+	// Heightmap over buffer_size(width, height) cells that belong to the caller, such as a memory-mapped file, the cells
+	// are left as they are
+	BasicHeightmap(unsigned int width, unsigned int height, Cell* cells)
+		: m_width(width), m_height(height)
+		, m_layout(width + 2 * BORDER, height + 2 * BORDER, ALIGNMENT / sizeof(Cell))
+		, m_buffer(cells, AlignedDelete{ false })
+	{
+	}
+
+	// Cells in the buffer of a width x height map, ghost border and padding included
+	static size_t buffer_size(unsigned int width, unsigned int height)
+	{
+		return Layout(width + 2 * BORDER, height + 2 * BORDER, ALIGNMENT / sizeof(Cell)).cell_count();
+	}
+
+	unsigned int width() const { return m_width; }
+	unsigned int height() const { return m_height; }
+	// Distance in cells between two vertically adjacent cells
+	size_t stride() const requires ROW_MAJOR { return m_layout.stride; }
+	const Layout& layout() const { return m_layout; }
+	// The whole buffer, in the order of the layout
+	Cell* data() { return m_buffer.get(); }
+	const Cell* data() const { return m_buffer.get(); }
+	// False for a heightmap over the cells of the caller, which must not be reassigned or resized
+	bool owns_buffer() const { return m_buffer.get_deleter().owned; }
+
+	// Pointer to the first cell of the given row, rows and columns in [-BORDER, 0) are part of the ghost border
+	Cell* row(int r) requires ROW_MAJOR { return m_buffer.get() + (size_t)(r + (int)BORDER) * m_layout.stride + BORDER; }
+	const Cell* row(int r) const requires ROW_MAJOR { return m_buffer.get() + (size_t)(r + (int)BORDER) * m_layout.stride + BORDER; }
+
+	// Row-major maps go through the row pointer, which the scalar kernel compiles to the tightest address arithmetic
+	Cell& at(int r, int c)
+	{
+		if constexpr (ROW_MAJOR)
+		{
+			return row(r)[c];
+		}
+		return m_buffer[index(r, c)];
+	}
+	Cell at(int r, int c) const
+	{
+		if constexpr (ROW_MAJOR)
+		{
+			return row(r)[c];
+		}
+		return m_buffer[index(r, c)];
+	}
+
+	Cell& operator[](std::pair<unsigned int, unsigned int> point)
+	{
+		if constexpr (ROW_MAJOR)
+		{
+			return row(point.first)[point.second];
+		}
+		return at(point.first, point.second);
+	}
+	Cell operator[](std::pair<unsigned int, unsigned int> point) const
+	{
+		if constexpr (ROW_MAJOR)
+		{
+			return row(point.first)[point.second];
+		}
+		return at(point.first, point.second);
+	}
+
+	// The cell and its four neighbours, for kernels that step through the buffer themselves
+	struct Neighbourhood
+	{
+		Cell* center;
+		ptrdiff_t up, down, left, right;	// Offsets from center
+	};
+	Neighbourhood neighbourhood(int r, int c) requires (!ROW_MAJOR)
+	{
+		size_t layout_r = (size_t)(r + (int)BORDER);
+		size_t layout_c = (size_t)(c + (int)BORDER);
+		return { m_buffer.get() + m_layout.index(layout_r, layout_c), m_layout.up(layout_r), m_layout.down(layout_r), m_layout.left(layout_c), m_layout.right(layout_c) };
+	}
+
+	// Copies the edge cells into the ghost border
+	void refresh_border() { refresh_border(0, m_height); }
+
+	// Copies the edge cells of rows [row_begin, row_end) into the ghost border, together with the ghost rows above the
+	// first and below the last row of the map when the range includes them
+	void refresh_border(unsigned int row_begin, unsigned int row_end)
+	{
+		if constexpr (ROW_MAJOR)
+		{
+			for (int r = (int)row_begin; r < (int)row_end; r++)
+			{
+				Cell* cells = row(r);
+				std::fill(cells - BORDER, cells, cells[0]);
+				std::fill(cells + m_width, cells + m_width + BORDER, cells[m_width - 1]);
+			}
+			for (int b = 1; b <= (int)BORDER; b++)
+			{
+				if (row_begin == 0)
+				{
+					std::copy(row(0) - BORDER, row(0) + m_width + BORDER, row(-b) - BORDER);
+				}
+				if (row_end == m_height)
+				{
+					std::copy(row(m_height - 1) - BORDER, row(m_height - 1) + m_width + BORDER, row(m_height - 1 + b) - BORDER);
+				}
+			}
+		}
+		else
+		{
+			int width = (int)m_width;
+			int height = (int)m_height;
+			for (int r = (int)row_begin; r < (int)row_end; r++)
+			{
+				for (int b = 1; b <= (int)BORDER; b++)
+				{
+					at(r, -b) = at(r, 0);
+					at(r, width - 1 + b) = at(r, width - 1);
+				}
+			}
+			for (int b = 1; b <= (int)BORDER; b++)
+			{
+				for (int c = -(int)BORDER; c < width + (int)BORDER; c++)
+				{
+					if (row_begin == 0)
+					{
+						at(-b, c) = at(0, c);
+					}
+					if (row_end == m_height)
+					{
+						at(height - 1 + b, c) = at(height - 1, c);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	struct AlignedDelete
+	{
+		bool owned = true;	// False for the buffer of the caller
+
+		void operator()(Cell* buffer) const
+		{
+			if (owned)
+			{
+				::operator delete[](buffer, std::align_val_t(ALIGNMENT));
+			}
+		}
+	};
+
+	static Cell* allocate(size_t count)
+	{
+		return static_cast<Cell*>(::operator new[](count * sizeof(Cell), std::align_val_t(ALIGNMENT)));
+	}
+
+	size_t index(int r, int c) const { return m_layout.index((size_t)(r + (int)BORDER), (size_t)(c + (int)BORDER)); }
+
+	unsigned int m_width;
+	unsigned int m_height;
+	Layout m_layout;
+	std::unique_ptr<Cell[], AlignedDelete> m_buffer;
+};
+
+using Heightmap = BasicHeightmap<float>;
+template <size_t Side>
+using BasicBlockedHeightmap = BasicHeightmap<float, BasicBlockedLayout<Side>>;
+using BlockedHeightmap = BasicBlockedHeightmap<HEIGHTMAP_BLOCK_SIDE>;
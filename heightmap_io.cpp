@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "heightmap_io.h"
+#include "lodepng.h"
+
+std::optional<Heightmap> load_png_heightmap(const std::string& file_name, std::string& error)
+{
+	std::vector<unsigned char> file;
+	unsigned int status = lodepng::load_file(file, file_name);
+	if (status)
+	{
+		error = "decoder error " + std::to_string(status) + ": " + lodepng_error_text(status);
+		return std::nullopt;
+	}
+
+	// Only 16-bit sources need the wider samples, everything else fits in a byte per pixel
+	unsigned int width, height;
+	lodepng::State state;
+	status = lodepng_inspect(&width, &height, &state, file.data(), file.size());
+	unsigned int bit_depth = !status && state.info_png.color.bitdepth == 16 ? 16 : 8;
+
+	std::vector<unsigned char> grey;
+	if (!status)
+	{
+		status = lodepng::decode(grey, width, height, file, LCT_GREY, bit_depth);
+	}
+	if (status)
+	{
+		error = "decoder error " + std::to_string(status) + ": " + lodepng_error_text(status);
+		return std::nullopt;
+	}
+	// The compressed file is not needed any more, release it before the heightmap is allocated
+	std::vector<unsigned char>().swap(file);
+
+	Heightmap heights(width, height);
+	for (unsigned int i = 0; i < height; i++)
+	{
+		float* cells = heights.row(i);
+		if (bit_depth == 16)
+		{
+			// Big-endian samples, scaled so that 65535 maps to 255
+			const unsigned char* samples = grey.data() + (size_t)i * width * 2;
+			for (unsigned int j = 0; j < width; j++)
+			{
+				cells[j] = (float)(samples[2 * j] << 8 | samples[2 * j + 1]) * (255.0f / 65535.0f);
+			}
+		}
+		else
+		{
+			const unsigned char* samples = grey.data() + (size_t)i * width;
+			for (unsigned int j = 0; j < width; j++)
+			{
+				cells[j] = (float)samples[j];
+			}
+		}
+	}
+	return heights;
+}
+
+bool parse_png_preset(const std::string& name, PngPreset& preset)
+{
+	const std::pair<const char*, PngPreset> presets[] = {
+		{ "store", PngPreset::Store }, { "fast", PngPreset::Fast }, { "default", PngPreset::Default }, { "max", PngPreset::Max } };
+	for (const auto& [preset_name, value] : presets)
+	{
+		if (name == preset_name)
+		{
+			preset = value;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Maps the preset onto the deflate settings and the scanline filter strategy of the encoder
+static void apply_png_preset(PngPreset preset, LodePNGEncoderSettings& encoder)
+{
+	LodePNGCompressSettings& zlib = encoder.zlibsettings;
+	switch (preset)
+	{
+	case PngPreset::Store:
+		zlib.btype = 0;
+		zlib.use_lz77 = 0;
+		encoder.filter_strategy = LFS_ZERO;
+		break;
+	case PngPreset::Fast:
+		// Heightmaps are smooth, so a fixed Paeth filter gets most of the gain of the heuristics for a fifth of the work
+		zlib.btype = 1;
+		zlib.windowsize = 512;
+		zlib.nicematch = 32;
+		zlib.lazymatching = 0;
+		encoder.filter_strategy = LFS_FOUR;
+		break;
+	case PngPreset::Default:
+		break;
+	case PngPreset::Max:
+		zlib.windowsize = 32768;
+		zlib.nicematch = 258;
+		encoder.filter_strategy = LFS_ENTROPY;
+		break;
+	}
+}
+
+bool save_png_heightmap(Heightmap heights, const std::string& file_name, const PngOutputOptions& options, std::string& error)
+{
+	unsigned int width = heights.width();
+	unsigned int height = heights.height();
+	bool wide = options.bit_depth == 16;
+
+	// One grey sample per pixel, 16-bit samples are big-endian
+	std::vector<unsigned char> image((size_t)width * height * (wide ? 2 : 1));
+	for (unsigned int i = 0; i < height; i++)
+	{
+		const float* cells = heights.row(i);
+		if (wide)
+		{
+			unsigned char* samples = image.data() + (size_t)i * width * 2;
+			for (unsigned int j = 0; j < width; j++)
+			{
+				unsigned int value = (unsigned int)(std::clamp(cells[j], 0.0f, 255.0f) * (65535.0f / 255.0f) + 0.5f);
+				samples[2 * j] = (unsigned char)(value >> 8);
+				samples[2 * j + 1] = (unsigned char)value;
+			}
+		}
+		else
+		{
+			unsigned char* samples = image.data() + (size_t)i * width;
+			for (unsigned int j = 0; j < width; j++)
+			{
+				// To ensure type conversion safety
+				samples[j] = (unsigned char)std::clamp(cells[j], 0.0f, 255.0f);
+			}
+		}
+	}
+
+	// The floats are larger than the samples, free them before the encoder allocates its own buffers
+	heights = Heightmap(0, 0);
+
+	// Write the samples as they are: auto_convert would scan the whole image for a smaller colour type first
+	lodepng::State state;
+	state.info_raw.colortype = LCT_GREY;
+	state.info_raw.bitdepth = options.bit_depth;
+	state.info_png.color.colortype = LCT_GREY;
+	state.info_png.color.bitdepth = options.bit_depth;
+	state.encoder.auto_convert = 0;
+	apply_png_preset(options.preset, state.encoder);
+
+	std::vector<unsigned char> png;
+	unsigned int status = lodepng::encode(png, image, width, height, state);
+	if (!status)
+	{
+		status = lodepng::save_file(png, file_name);
+	}
+	if (status)
+	{
+		error = "encoder error " + std::to_string(status) + ": " + lodepng_error_text(status);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "heightmap.h"
+
+// Decodes a PNG straight into a heightmap, heights are on the 0-255 scale of an 8-bit image
+// 8-bit and lower images are decoded to one grey byte per pixel, 16-bit images to two, and colour images contribute
+// their R channel; the grey samples are converted to floats in the same pass that fills the heightmap
+// Returns std::nullopt and describes the problem in error if the file cannot be decoded
+std::optional<Heightmap> load_png_heightmap(const std::string& file_name, std::string& error);
+
+// Trade-off between encode time and file size of the output PNGs
+enum class PngPreset
+{
+	Store,		// Uncompressed deflate blocks, no filtering: the fastest, for intermediate files
+	Fast,		// Fixed Huffman codes, a small LZ77 window and the Paeth filter on every row
+	Default,	// lodepng's defaults: dynamic Huffman codes, 2 KiB window, minimum-sum filter heuristic
+	Max,		// 32 KiB window, longest matches and the entropy filter heuristic
+};
+
+struct PngOutputOptions
+{
+	unsigned int bit_depth = 8;		// 8 or 16, 16-bit outputs keep the fraction of the heights
+	PngPreset preset = PngPreset::Default;
+};
+
+// Parses "store", "fast", "default" or "max", returns false if the name is unknown
+bool parse_png_preset(const std::string& name, PngPreset& preset);
+
+// Encodes the heightmap, clamped to 0-255, as a single-channel greyscale PNG
+// 16-bit outputs scale the heights so that 255 maps to 65535
+// Takes the heightmap by value so that it can be released as soon as the pixels are converted, move it in when done with it
+// Returns false and describes the problem in error if the file cannot be written
+bool save_png_heightmap(Heightmap heights, const std::string& file_name, const PngOutputOptions& options, std::string& error);
@@ -0,0 +1,269 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "heightmap_io.h"
+#include "image_job.h"
+#include "mapped_heightmap.h"
+#include "parallel.h"
+
+bool load_manifest(const std::string& file_name, std::vector<ImageJob>& jobs, std::string& error)
+{
+	std::ifstream file(file_name);
+	if (!file)
+	{
+		error = "cannot open " + file_name;
+		return false;
+	}
+
+	std::string line;
+	for (unsigned int line_number = 1; std::getline(file, line); line_number++)
+	{
+		std::istringstream fields(line.substr(0, line.find('#')));
+		ImageJob job;
+		std::string extra;
+		if (!(fields >> job.input_file_name))
+		{
+			continue; // Blank or comment-only line
+		}
+		if (!(fields >> job.output_file_name) || fields >> extra)
+		{
+			error = file_name + ":" + std::to_string(line_number) + ": expected 'input output', got '" + line + "'";
+			return false;
+		}
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+// A file on its way through the pipeline, owned by one stage at a time
+struct ImageInFlight
+{
+	size_t index = 0;
+	std::optional<Heightmap> heights;
+	std::unique_ptr<MappedHeightmapFile> mapped;	// Output file eroded in place out of core, for tiled to tiled jobs
+	std::unique_ptr<MappedRowsFile> mapped_rows;	// Output file eroded in place by the selected engine, for rows to rows jobs
+	MappedFormat output_format = MappedFormat::Tiles;	// Of a mapped heightmap output
+};
+
+using pipeline_clock = std::chrono::steady_clock;
+
+static double seconds_since(pipeline_clock::time_point start)
+{
+	return std::chrono::duration<double>(pipeline_clock::now() - start).count();
+}
+
+// Copies the input to the output and maps the copy, which the erode stage erodes in place
+// Returns nullptr, with the error in result, if the input cannot be copied or mapped
+template <typename File>
+static std::unique_ptr<File> copy_and_map(const ImageJob& job, ImageJobResult& result)
+{
+	std::error_code copy_error;
+	std::filesystem::copy_file(job.input_file_name, job.output_file_name, std::filesystem::copy_options::overwrite_existing, copy_error);
+	if (copy_error)
+	{
+		result.error = "cannot copy " + job.input_file_name + " to " + job.output_file_name + ": " + copy_error.message();
+		return nullptr;
+	}
+	std::unique_ptr<File> file = File::open(job.output_file_name, result.error);
+	if (file)
+	{
+		result.width = file->heights().width();
+		result.height = file->heights().height();
+	}
+	return file;
+}
+
+// Returns false, with the error in result, if the input cannot be decoded
+static bool decode_stage(const ImageJob& job, ImageInFlight& item, const ImageJobSettings& settings, ImageJobResult& result)
+{
+	auto start = pipeline_clock::now();
+	std::optional<MappedHeightmapInfo> input_info;
+	if (is_mapped_heightmap_file(job.input_file_name))
+	{
+		input_info = read_mapped_heightmap_info(job.input_file_name, result.error);
+		if (!input_info)
+		{
+			return false;
+		}
+	}
+	item.output_format = settings.mapped_format.value_or(input_info ? input_info->format : MappedFormat::Tiles);
+
+	// Float cells at scale 1 are already what the engines erode, so the output starts as a copy of the input
+	if (input_info && is_mapped_heightmap_file(job.output_file_name) && input_info->format == item.output_format
+		&& item.output_format != MappedFormat::Uint16 && input_info->scale == 1.0f)
+	{
+		if (item.output_format == MappedFormat::Tiles)
+		{
+			item.mapped = copy_and_map<MappedHeightmapFile>(job, result);
+		}
+		else
+		{
+			item.mapped_rows = copy_and_map<MappedRowsFile>(job, result);
+		}
+		result.decode_time = seconds_since(start);
+		return item.mapped || item.mapped_rows;
+	}
+
+	if (input_info)
+	{
+		item.heights = load_mapped_heightmap(job.input_file_name, result.error);
+	}
+	else
+	{
+		item.heights = load_png_heightmap(job.input_file_name, result.error);
+	}
+	if (!item.heights)
+	{
+		return false;
+	}
+	result.width = item.heights->width();
+	result.height = item.heights->height();
+	result.decode_time = seconds_since(start);
+	return true;
+}
+
+// Returns false, with the error in result, if the erosion cannot take its checkpoints or stopped at one
+static bool erode_stage(const ImageJob& job, ImageInFlight& item, const ImageJobSettings& settings, ImageJobResult& result)
+{
+	auto start = pipeline_clock::now();
+	bool eroded = true;
+	if (item.mapped)
+	{
+		if (settings.checkpoints)
+		{
+			result.error = "out-of-core jobs take no checkpoints, the tiled engine always has droplets in flight";
+			return false;
+		}
+		erode_mapped(*item.mapped, settings.params, settings.thread_count);
+	}
+	else
+	{
+		CheckpointSettings checkpoint = settings.checkpoint;
+		checkpoint.file_name = settings.checkpoints ? job.output_file_name + CHECKPOINT_EXTENSION : std::string();
+		Heightmap& heights = item.mapped_rows ? item.mapped_rows->heights() : *item.heights;
+		eroded = erode_heightmap(heights, settings.params, settings.engine, settings.thread_count, checkpoint, result.error);
+	}
+	result.erode_time = seconds_since(start);
+	return eroded;
+}
+
+static void encode_stage(const ImageJob& job, ImageInFlight& item, const ImageJobSettings& settings, ImageJobResult& result)
+{
+	auto start = pipeline_clock::now();
+	if (item.mapped)
+	{
+		result.succeeded = item.mapped->flush(result.error);
+		item.mapped.reset();
+	}
+	else if (item.mapped_rows)
+	{
+		result.succeeded = item.mapped_rows->flush(result.error);
+		item.mapped_rows.reset();
+	}
+	else if (is_mapped_heightmap_file(job.output_file_name))
+	{
+		result.succeeded = save_mapped_heightmap(*item.heights, job.output_file_name, item.output_format, result.error);
+		item.heights.reset();
+	}
+	else
+	{
+		result.succeeded = save_png_heightmap(std::move(*item.heights), job.output_file_name, settings.output, result.error);
+	}
+	if (result.succeeded && settings.checkpoints)
+	{
+		std::error_code remove_error;
+		std::filesystem::remove(job.output_file_name + CHECKPOINT_EXTENSION, remove_error);
+	}
+	result.encode_time = seconds_since(start);
+}
+
+ImageJobResult run_image_job(const ImageJob& job, const ImageJobSettings& settings)
+{
+	ImageJobResult result;
+	ImageInFlight item;
+	if (decode_stage(job, item, settings, result) && erode_stage(job, item, settings, result))
+	{
+		encode_stage(job, item, settings, result);
+	}
+	return result;
+}
+
+std::vector<ImageJobResult> run_image_jobs(const std::vector<ImageJob>& jobs, const ImageJobSettings& settings, unsigned int job_count)
+{
+	// Every job writes to its own slot of the results, so the stages share nothing but the queues
+	std::vector<ImageJobResult> results(jobs.size());
+	size_t queue_capacity = settings.queue_capacity ? settings.queue_capacity : job_count;
+	BoundedQueue<ImageInFlight> decoded(queue_capacity);
+	BoundedQueue<ImageInFlight> eroded(queue_capacity);
+
+	// Stage 1 reads ahead of the erosion workers until the queue is full
+	std::jthread decoder([&]()
+	{
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			ImageInFlight item;
+			item.index = i;
+			if (decode_stage(jobs[i], item, settings, results[i]))
+			{
+				decoded.push(std::move(item));
+			}
+		}
+		decoded.close();
+	});
+
+	// Stage 3 writes the finished files in the order they come out of the erosion
+	std::jthread encoder([&]()
+	{
+		while (std::optional<ImageInFlight> item = eroded.pop())
+		{
+			encode_stage(jobs[item->index], *item, settings, results[item->index]);
+		}
+	});
+
+	// Stage 2, the simulation, runs on the calling thread and job_count - 1 workers
+	parallel_for(job_count, job_count, [&](size_t)
+	{
+		while (std::optional<ImageInFlight> item = decoded.pop())
+		{
+			if (erode_stage(jobs[item->index], *item, settings, results[item->index]))
+			{
+				eroded.push(std::move(*item));
+			}
+		}
+	});
+	eroded.close();
+	return results;
+}
+
+void print_timing_summary(const std::vector<ImageJob>& jobs, const std::vector<ImageJobResult>& results, double wall_time)
+{
+	double decode_total = 0.0, erode_total = 0.0, encode_total = 0.0;
+	size_t failed = 0;
+	char line[160];
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		const ImageJobResult& result = results[i];
+		if (!result.succeeded)
+		{
+			std::cout << jobs[i].input_file_name << ": FAILED, " << result.error << std::endl;
+			failed++;
+			continue;
+		}
+		std::snprintf(line, sizeof(line), "%5ux%-5u decode %8.1f ms  erode %9.1f ms  encode %8.1f ms  ",
+			result.width, result.height, result.decode_time * 1e3, result.erode_time * 1e3, result.encode_time * 1e3);
+		std::cout << line << jobs[i].input_file_name << " -> " << jobs[i].output_file_name << std::endl;
+		decode_total += result.decode_time;
+		erode_total += result.erode_time;
+		encode_total += result.encode_time;
+	}
+
+	std::snprintf(line, sizeof(line), "%zu files (%zu failed) in %.2f s wall, decode %.2f s, erode %.2f s, encode %.2f s summed over files",
+		jobs.size(), failed, wall_time, decode_total, erode_total, encode_total);
+	std::cout << line << std::endl;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "erosion.h"
+#include "heightmap_io.h"
+
+// One input heightmap and the file its eroded copy is written to
+struct ImageJob
+{
+	std::string input_file_name;
+	std::string output_file_name;
+};
+
+// Outcome of run_image_job, times are in seconds
+struct ImageJobResult
+{
+	bool succeeded = false;
+	std::string error;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	double decode_time = 0.0;
+	double erode_time = 0.0;
+	double encode_time = 0.0;
+};
+
+// Settings shared by every job of a run
+struct ImageJobSettings
+{
+	ErosionParams params;
+	ErosionEngine engine = ErosionEngine::Sequential;
+	unsigned int thread_count = 1;	// Threads of the tiled engine, per job
+	PngOutputOptions output;
+	size_t queue_capacity = 0;		// Files that may wait between two pipeline stages, 0 means one per erosion worker
+	std::optional<MappedFormat> mapped_format;	// Format of mapped heightmap outputs, by default that of a mapped input, else Tiles
+	bool checkpoints = false;		// Save the progress of every job next to its output, see CHECKPOINT_EXTENSION
+	CheckpointSettings checkpoint;	// Interval, stop and resume of the checkpoints, the file name is set per job
+};
+
+// Reads "input output" pairs separated by whitespace, one per line, '#' starts a comment
+// Returns false and describes the first problem in error if the file cannot be read or has an invalid line
+bool load_manifest(const std::string& file_name, std::vector<ImageJob>& jobs, std::string& error);
+
+// Decodes the input PNG, erodes it and encodes the result to the output PNG, see save_png_heightmap
+// With settings.checkpoints, the erosion saves its progress to the output file name followed by CHECKPOINT_EXTENSION, which
+// is removed once the output is written, and settings.checkpoint.resume continues from there
+// Either file may be a mapped heightmap instead, see MAPPED_HEIGHTMAP_EXTENSION. When both are, with the same float format
+// at scale 1, the output is a copy of the input eroded in place: tiled files by erode_mapped, so that the map never has to
+// fit in memory, and row-major files by erode_heightmap with the selected engine, without decoding or copying a cell
+ImageJobResult run_image_job(const ImageJob& job, const ImageJobSettings& settings);
+
+// Runs every job through a three-stage pipeline: one thread decodes, job_count workers erode and one thread encodes,
+// so that the PNG codecs of the neighbouring files overlap with the simulation. The stages are connected by bounded
+// queues, which caps the files held in memory at 2 * queue_capacity + job_count + 2
+// Returns the results in the order of the jobs
+std::vector<ImageJobResult> run_image_jobs(const std::vector<ImageJob>& jobs, const ImageJobSettings& settings, unsigned int job_count);
+
+// Prints one line per job with its decode, erode and encode times, followed by the totals
+void print_timing_summary(const std::vector<ImageJob>& jobs, const std::vector<ImageJobResult>& results, double wall_time);
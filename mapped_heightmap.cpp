@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_heightmap.h"
+
+#define MAPPED_HEIGHTMAP_VERSION 2	// Version 2 added the format and the scale
+
+// First bytes of the header page, the samples are in native byte order
+struct MappedHeightmapHeader
+{
+	char magic[8];		// "EROSHMAP"
+	uint32_t version;
+	uint32_t format;	// MappedFormat
+	uint32_t tile_side;	// MAPPED_TILE_SIDE for tiled files, 0 otherwise
+	uint32_t width;
+	uint32_t height;
+	float scale;
+};
+
+static const char MAPPED_HEIGHTMAP_MAGIC[8] = { 'E', 'R', 'O', 'S', 'H', 'M', 'A', 'P' };
+
+static_assert(sizeof(MappedHeightmapHeader) <= MAPPED_HEADER_SIZE);
+static_assert(MAPPED_HEADER_SIZE % MappedHeightmap::ALIGNMENT == 0);
+
+bool parse_mapped_format(const std::string& name, MappedFormat& format)
+{
+	const std::pair<const char*, MappedFormat> formats[] = {
+		{ "tiles", MappedFormat::Tiles }, { "rows", MappedFormat::Rows }, { "uint16", MappedFormat::Uint16 } };
+	for (const auto& [format_name, value] : formats)
+	{
+		if (name == format_name)
+		{
+			format = value;
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t mapping_size(const MappedHeightmapInfo& info)
+{
+	switch (info.format)
+	{
+	case MappedFormat::Tiles:
+		return MAPPED_HEADER_SIZE + MappedHeightmap::buffer_size(info.width, info.height) * sizeof(float);
+	case MappedFormat::Rows:
+		return MAPPED_HEADER_SIZE + Heightmap::buffer_size(info.width, info.height) * sizeof(float);
+	default:
+		return MAPPED_HEADER_SIZE + (size_t)info.width * info.height * sizeof(uint16_t);
+	}
+}
+
+static std::string system_error(const std::string& what, const std::string& file_name)
+{
+	return what + " " + file_name + ": " + std::strerror(errno);
+}
+
+// Reads and checks the header of an open file against the size of the file
+static bool read_header(int file, const std::string& file_name, MappedHeightmapInfo& info, std::string& error)
+{
+	MappedHeightmapHeader header{};
+	struct stat status;
+	if (pread(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || fstat(file, &status) != 0
+		|| std::memcmp(header.magic, MAPPED_HEIGHTMAP_MAGIC, sizeof(header.magic)) != 0)
+	{
+		error = file_name + " is not a mapped heightmap";
+		return false;
+	}
+	if (header.version != MAPPED_HEIGHTMAP_VERSION)
+	{
+		error = file_name + " has version " + std::to_string(header.version) + ", expected version " + std::to_string(MAPPED_HEIGHTMAP_VERSION);
+		return false;
+	}
+	uint32_t tile_side = header.format == (uint32_t)MappedFormat::Tiles ? MAPPED_TILE_SIDE : 0;
+	if (header.format > (uint32_t)MappedFormat::Uint16 || header.tile_side != tile_side || !(header.scale > 0.0f))
+	{
+		error = file_name + " has format " + std::to_string(header.format) + ", tiles of " + std::to_string(header.tile_side)
+			+ " and scale " + std::to_string(header.scale) + ", which this version cannot read";
+		return false;
+	}
+
+	info.format = (MappedFormat)header.format;
+	info.width = header.width;
+	info.height = header.height;
+	info.scale = header.scale;
+	size_t size = mapping_size(info);
+	if ((size_t)status.st_size != size)
+	{
+		error = file_name + " is truncated, expected " + std::to_string(size) + " bytes for " + std::to_string(info.width) + "x" + std::to_string(info.height);
+		return false;
+	}
+	return true;
+}
+
+// Creates the file, sized for the map and sparse until the samples are written, and maps it with its header filled in
+// Returns MAP_FAILED and describes the problem in error if the file cannot be created
+static void* create_mapping(const std::string& file_name, const MappedHeightmapInfo& info, int& file, size_t& size, std::string& error)
+{
+	file = ::open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+	{
+		error = system_error("cannot create", file_name);
+		return MAP_FAILED;
+	}
+	size = mapping_size(info);
+	void* mapping = ftruncate(file, (off_t)size) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+	if (mapping == MAP_FAILED)
+	{
+		error = system_error("cannot map", file_name);
+		close(file);
+		return MAP_FAILED;
+	}
+
+	MappedHeightmapHeader header{};
+	std::memcpy(header.magic, MAPPED_HEIGHTMAP_MAGIC, sizeof(header.magic));
+	header.version = MAPPED_HEIGHTMAP_VERSION;
+	header.format = (uint32_t)info.format;
+	header.tile_side = info.format == MappedFormat::Tiles ? MAPPED_TILE_SIDE : 0;
+	header.width = info.width;
+	header.height = info.height;
+	header.scale = info.scale;
+	std::memcpy(mapping, &header, sizeof(header));
+	return mapping;
+}
+
+// Opens the file and maps all of it after checking its header
+// Returns MAP_FAILED and describes the problem in error if the file cannot be opened or is not a mapped heightmap
+static void* open_mapping(const std::string& file_name, bool writable, MappedHeightmapInfo& info, int& file, size_t& size, std::string& error)
+{
+	file = ::open(file_name.c_str(), writable ? O_RDWR : O_RDONLY);
+	if (file < 0)
+	{
+		error = system_error("cannot open", file_name);
+		return MAP_FAILED;
+	}
+	if (!read_header(file, file_name, info, error))
+	{
+		close(file);
+		return MAP_FAILED;
+	}
+	size = mapping_size(info);
+	void* mapping = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+	if (mapping == MAP_FAILED)
+	{
+		error = system_error("cannot map", file_name);
+		close(file);
+	}
+	return mapping;
+}
+
+template <typename Grid>
+MappedGridFile<Grid>::MappedGridFile(int file, void* mapping, size_t mapping_size, unsigned int width, unsigned int height)
+	: m_file(file), m_mapping(mapping), m_mapping_size(mapping_size)
+	, m_heights(width, height, reinterpret_cast<float*>(static_cast<char*>(mapping) + MAPPED_HEADER_SIZE))
+{
+}
+
+template <typename Grid>
+MappedGridFile<Grid>::~MappedGridFile()
+{
+	munmap(m_mapping, m_mapping_size);
+	close(m_file);
+}
+
+template <typename Grid>
+std::unique_ptr<MappedGridFile<Grid>> MappedGridFile<Grid>::create(const std::string& file_name, unsigned int width, unsigned int height, std::string& error)
+{
+	MappedHeightmapInfo info{ FORMAT, width, height, 1.0f };
+	int file;
+	size_t size;
+	void* mapping = create_mapping(file_name, info, file, size, error);
+	if (mapping == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	return std::unique_ptr<MappedGridFile>(new MappedGridFile(file, mapping, size, width, height));
+}
+
+template <typename Grid>
+std::unique_ptr<MappedGridFile<Grid>> MappedGridFile<Grid>::open(const std::string& file_name, std::string& error)
+{
+	MappedHeightmapInfo info;
+	int file;
+	size_t size;
+	void* mapping = open_mapping(file_name, true, info, file, size, error);
+	if (mapping == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	if (info.format != FORMAT || info.scale != 1.0f)
+	{
+		error = file_name + " holds no float cells of the expected layout at scale 1, it can only be converted through memory";
+		munmap(mapping, size);
+		close(file);
+		return nullptr;
+	}
+	if constexpr (!Grid::ROW_MAJOR)
+	{
+		// Droplets hop between neighbouring tiles, read-ahead of the following pages would mostly be wasted
+		madvise(mapping, size, MADV_RANDOM);
+	}
+	return std::unique_ptr<MappedGridFile>(new MappedGridFile(file, mapping, size, info.width, info.height));
+}
+
+template <typename Grid>
+void MappedGridFile<Grid>::release_rows(unsigned int row_begin, unsigned int row_end) requires (!Grid::ROW_MAJOR)
+{
+	const typename Grid::Layout& layout = m_heights.layout();
+	size_t side = Grid::Layout::BLOCK_SIDE;
+	size_t first = row_begin == 0 ? 0 : (row_begin + Grid::BORDER + side - 1) / side;
+	size_t last = row_end >= m_heights.height() ? layout.block_rows : (row_end + Grid::BORDER) / side;
+	if (first >= last)
+	{
+		return;
+	}
+
+	// Both ends are rounded inwards to whole pages, a page that straddles a tile row that is still in use stays mapped
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t tile_row_bytes = layout.blocks_per_row * layout.BLOCK_CELLS * sizeof(float);
+	size_t begin = MAPPED_HEADER_SIZE + first * tile_row_bytes;
+	size_t end = MAPPED_HEADER_SIZE + last * tile_row_bytes;
+	begin = (begin + page_size - 1) / page_size * page_size;
+	end = end / page_size * page_size;
+	if (begin >= end)
+	{
+		return;
+	}
+	// Dropping the pages of a shared mapping keeps their data in the page cache, from where the kernel writes it back
+	char* pages = static_cast<char*>(m_mapping) + begin;
+	msync(pages, end - begin, MS_ASYNC);
+	madvise(pages, end - begin, MADV_DONTNEED);
+}
+
+template <typename Grid>
+bool MappedGridFile<Grid>::flush(std::string& error)
+{
+	if (msync(m_mapping, m_mapping_size, MS_SYNC) != 0)
+	{
+		error = std::string("cannot write the mapped heightmap: ") + std::strerror(errno);
+		return false;
+	}
+	return true;
+}
+
+template class MappedGridFile<MappedHeightmap>;
+template class MappedGridFile<Heightmap>;
+
+bool is_mapped_heightmap_file(const std::string& file_name)
+{
+	std::string extension = MAPPED_HEIGHTMAP_EXTENSION;
+	return file_name.size() >= extension.size() && file_name.compare(file_name.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+std::optional<MappedHeightmapInfo> read_mapped_heightmap_info(const std::string& file_name, std::string& error)
+{
+	int file = ::open(file_name.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		error = system_error("cannot open", file_name);
+		return std::nullopt;
+	}
+	MappedHeightmapInfo info;
+	bool valid = read_header(file, file_name, info, error);
+	close(file);
+	return valid ? std::optional<MappedHeightmapInfo>(info) : std::nullopt;
+}
+
+// Copies the map cells of the mapped grid into the heightmap, times scale
+template <typename Grid>
+static void copy_mapped_cells(const void* samples, const MappedHeightmapInfo& info, Heightmap& heights)
+{
+	// The grid only reads the caller's cells, which stay mapped read-only
+	Grid cells(info.width, info.height, const_cast<float*>(static_cast<const float*>(samples)));
+	for (unsigned int r = 0; r < info.height; r++)
+	{
+		for (unsigned int c = 0; c < info.width; c++)
+		{
+			heights.at(r, c) = cells.at(r, c) * info.scale;
+		}
+	}
+}
+
+std::optional<Heightmap> load_mapped_heightmap(const std::string& file_name, std::string& error)
+{
+	MappedHeightmapInfo info;
+	int file;
+	size_t size;
+	void* mapping = open_mapping(file_name, false, info, file, size, error);
+	if (mapping == MAP_FAILED)
+	{
+		return std::nullopt;
+	}
+	madvise(mapping, size, MADV_SEQUENTIAL);
+
+	const void* samples = static_cast<const char*>(mapping) + MAPPED_HEADER_SIZE;
+	Heightmap heights(info.width, info.height);
+	if (info.format == MappedFormat::Tiles)
+	{
+		copy_mapped_cells<MappedHeightmap>(samples, info, heights);
+	}
+	else if (info.format == MappedFormat::Rows)
+	{
+		copy_mapped_cells<Heightmap>(samples, info, heights);
+	}
+	else
+	{
+		const uint16_t* sample = static_cast<const uint16_t*>(samples);
+		for (unsigned int r = 0; r < info.height; r++)
+		{
+			float* cells = heights.row(r);
+			for (unsigned int c = 0; c < info.width; c++)
+			{
+				cells[c] = (float)*sample++ * info.scale;
+			}
+		}
+	}
+	munmap(mapping, size);
+	close(file);
+	return heights;
+}
+
+// Writes the heightmap to a new file of float cells laid out as a Grid
+template <typename Grid>
+static bool save_mapped_grid(const Heightmap& heights, const std::string& file_name, std::string& error)
+{
+	std::unique_ptr<MappedGridFile<Grid>> file = MappedGridFile<Grid>::create(file_name, heights.width(), heights.height(), error);
+	if (!file)
+	{
+		return false;
+	}
+	Grid& cells = file->heights();
+	for (unsigned int r = 0; r < heights.height(); r++)
+	{
+		for (unsigned int c = 0; c < heights.width(); c++)
+		{
+			cells.at(r, c) = heights.at(r, c);
+		}
+	}
+	cells.refresh_border();
+	return file->flush(error);
+}
+
+// Writes the heightmap as 16-bit samples, see save_mapped_heightmap for the scale
+static bool save_mapped_uint16(const Heightmap& heights, const std::string& file_name, std::string& error)
+{
+	float highest = 0.0f;
+	for (unsigned int r = 0; r < heights.height(); r++)
+	{
+		const float* cells = heights.row(r);
+		highest = std::max(highest, *std::max_element(cells, cells + heights.width()));
+	}
+	// The steps per level are computed like those of save_png_heightmap, so that PNG heights map to the same samples
+	float steps_per_level = highest > 255.0f ? 65535.0f / highest : 65535.0f / 255.0f;
+	MappedHeightmapInfo info{ MappedFormat::Uint16, heights.width(), heights.height(), highest > 255.0f ? highest / 65535.0f : 255.0f / 65535.0f };
+
+	int file;
+	size_t size;
+	void* mapping = create_mapping(file_name, info, file, size, error);
+	if (mapping == MAP_FAILED)
+	{
+		return false;
+	}
+	uint16_t* sample = reinterpret_cast<uint16_t*>(static_cast<char*>(mapping) + MAPPED_HEADER_SIZE);
+	for (unsigned int r = 0; r < heights.height(); r++)
+	{
+		const float* cells = heights.row(r);
+		for (unsigned int c = 0; c < heights.width(); c++)
+		{
+			*sample++ = (uint16_t)std::min(std::max(cells[c], 0.0f) * steps_per_level + 0.5f, 65535.0f);
+		}
+	}
+	bool written = msync(mapping, size, MS_SYNC) == 0;
+	if (!written)
+	{
+		error = system_error("cannot write", file_name);
+	}
+	munmap(mapping, size);
+	close(file);
+	return written;
+}
+
+bool save_mapped_heightmap(const Heightmap& heights, const std::string& file_name, MappedFormat format, std::string& error)
+{
+	if (format == MappedFormat::Tiles)
+	{
+		return save_mapped_grid<MappedHeightmap>(heights, file_name, error);
+	}
+	if (format == MappedFormat::Rows)
+	{
+		return save_mapped_grid<Heightmap>(heights, file_name, error);
+	}
+	return save_mapped_uint16(heights, file_name, error);
+}
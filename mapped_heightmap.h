@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "heightmap.h"
+
+#define MAPPED_TILE_SIDE 32					// 32x32 float cells fill one 4 KiB page, the tiles of erode_tiled are as large
+#define MAPPED_HEADER_SIZE 4096				// Bytes before the first cell, so that every tile starts on a page
+#define MAPPED_HEIGHTMAP_EXTENSION ".ehm"	// Files with this extension are read and written as mapped heightmaps
+
+// Float heights stored tile after tile, the layout of a MappedFormat::Tiles file
+using MappedHeightmap = BasicBlockedHeightmap<MAPPED_TILE_SIDE>;
+
+// How the samples of a mapped heightmap file are stored after the header page
+enum class MappedFormat : uint32_t
+{
+	Tiles,	// Float cells of a MappedHeightmap, ghost border included, eroded out of core by erode_mapped
+	Rows,	// Float cells of a Heightmap, ghost border and row padding included, eroded in place by any engine
+	Uint16,	// width x height unsigned 16-bit samples row after row, converted to floats to be eroded
+};
+
+// What the header of a mapped heightmap file says about its samples
+struct MappedHeightmapInfo
+{
+	MappedFormat format = MappedFormat::Tiles;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	float scale = 1.0f;	// Height of one sample step, a height is the stored sample times scale
+};
+
+// Parses "tiles", "rows" or "uint16"
+// Returns false if the name is not a format
+bool parse_mapped_format(const std::string& name, MappedFormat& format);
+
+// A mapped heightmap file of float cells, MappedFormat::Tiles for a MappedHeightmap and MappedFormat::Rows for a Heightmap,
+// mapped into memory so that the engines erode the file in place without copying it
+// The file holds a header page followed by the buffer of the Grid, ghost border included. The kernel reads a page in when a
+// droplet first touches it and writes the dirty pages back. On tiled files, release_rows() returns the pages of the tiles
+// that will not be touched for a while, which keeps the resident set at a few bands of tiles and lets maps larger than
+// RAM be eroded.
+template <typename Grid>
+class MappedGridFile
+{
+public:
+	static constexpr MappedFormat FORMAT = Grid::ROW_MAJOR ? MappedFormat::Rows : MappedFormat::Tiles;
+
+	// Creates a file for a width x height map, all heights 0
+	// Returns nullptr and describes the problem in error if the file cannot be created
+	static std::unique_ptr<MappedGridFile> create(const std::string& file_name, unsigned int width, unsigned int height, std::string& error);
+
+	// Maps an existing file for reading and writing
+	// Returns nullptr and describes the problem in error if the file cannot be opened, or is not a mapped heightmap of
+	// FORMAT with a scale of 1
+	static std::unique_ptr<MappedGridFile> open(const std::string& file_name, std::string& error);
+
+	MappedGridFile(const MappedGridFile&) = delete;
+	MappedGridFile& operator=(const MappedGridFile&) = delete;
+	~MappedGridFile();
+
+	Grid& heights() { return m_heights; }
+
+	// Schedules the writeback of map rows [row_begin, row_end) and drops their pages from the process, the rows stay valid
+	// and are read back from the file when touched again. Only whole tile rows are released, the ghost border goes with
+	// the first and last rows.
+	void release_rows(unsigned int row_begin, unsigned int row_end) requires (!Grid::ROW_MAJOR);
+
+	// Writes every dirty page back to the file
+	// Returns false and describes the problem in error if the pages cannot be written
+	bool flush(std::string& error);
+
+private:
+	MappedGridFile(int file, void* mapping, size_t mapping_size, unsigned int width, unsigned int height);
+
+	int m_file;
+	void* m_mapping;
+	size_t m_mapping_size;
+	Grid m_heights;
+};
+
+using MappedHeightmapFile = MappedGridFile<MappedHeightmap>;
+using MappedRowsFile = MappedGridFile<Heightmap>;
+
+// True if the file name ends with MAPPED_HEIGHTMAP_EXTENSION
+bool is_mapped_heightmap_file(const std::string& file_name);
+
+// Reads the header of a mapped heightmap file
+// Returns std::nullopt and describes the problem in error if the file cannot be read or is not a valid mapped heightmap
+std::optional<MappedHeightmapInfo> read_mapped_heightmap_info(const std::string& file_name, std::string& error);
+
+// Reads a whole mapped heightmap file of any format into a heightmap, the samples multiplied by the scale
+// Returns std::nullopt and describes the problem in error if the file cannot be read
+std::optional<Heightmap> load_mapped_heightmap(const std::string& file_name, std::string& error);
+
+// Writes the heightmap to a new mapped heightmap file of the given format
+// Float formats are written with a scale of 1. Uint16 files get the scale of a 16-bit PNG, 255 / 65535 levels per step, so
+// that PNG heights survive the round trip, or a coarser one that fits the highest cell if the map rises above 255 levels.
+// Heights below 0 are clamped.
+// Returns false and describes the problem in error if the file cannot be written
+bool save_mapped_heightmap(const Heightmap& heights, const std::string& file_name, MappedFormat format, std::string& error);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Runs task(i) for every i in [0, count), spread over thread_count threads (including the calling thread)
+// Indices are handed out one at a time, so tasks of uneven cost still balance out
+template <typename Task>
+void parallel_for(unsigned int thread_count, size_t count, const Task& task)
+{
+	std::atomic<size_t> next_index = 0;
+	auto worker = [&]()
+	{
+		for (size_t i = next_index++; i < count; i = next_index++)
+		{
+			task(i);
+		}
+	};
+
+	std::vector<std::jthread> threads;
+	for (unsigned int i = 1; i < std::min<size_t>(thread_count, count); i++)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+}
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cmath>
+
+#include "pyramid.h"
+
+Heightmap downsample_heightmap(const Heightmap& heights)
+{
+	unsigned int width = (heights.width() + 1) / 2;
+	unsigned int height = (heights.height() + 1) / 2;
+	Heightmap coarse(width, height);
+	for (unsigned int r = 0; r < height; r++)
+	{
+		unsigned int r_end = std::min(2 * r + 2, heights.height());
+		for (unsigned int c = 0; c < width; c++)
+		{
+			unsigned int c_end = std::min(2 * c + 2, heights.width());
+			float sum = 0.0f;
+			for (unsigned int fine_r = 2 * r; fine_r < r_end; fine_r++)
+			{
+				for (unsigned int fine_c = 2 * c; fine_c < c_end; fine_c++)
+				{
+					sum += heights.at(fine_r, fine_c);
+				}
+			}
+			coarse.at(r, c) = sum / (float)((r_end - 2 * r) * (c_end - 2 * c));
+		}
+	}
+	return coarse;
+}
+
+// Coarse cells on either side of a fine row or column and the weight of the second one, the center of fine cell i lies at
+// (i + 0.5) / 2 - 0.5 in coarse cells, clamped to the centers of the edge cells
+struct CoarseSpan
+{
+	unsigned int first, second;
+	float weight;
+};
+
+static CoarseSpan coarse_span(unsigned int fine, unsigned int coarse_size)
+{
+	float position = std::clamp(((float)fine + 0.5f) * 0.5f - 0.5f, 0.0f, (float)(coarse_size - 1));
+	unsigned int first = (unsigned int)position;
+	return { first, std::min(first + 1, coarse_size - 1), position - (float)first };
+}
+
+void add_upsampled_delta(Heightmap& heights, const Heightmap& before, const Heightmap& after)
+{
+	for (unsigned int r = 0; r < heights.height(); r++)
+	{
+		CoarseSpan rows = coarse_span(r, before.height());
+		for (unsigned int c = 0; c < heights.width(); c++)
+		{
+			CoarseSpan columns = coarse_span(c, before.width());
+			auto delta = [&](unsigned int coarse_r, unsigned int coarse_c) { return after.at(coarse_r, coarse_c) - before.at(coarse_r, coarse_c); };
+			float top = std::lerp(delta(rows.first, columns.first), delta(rows.first, columns.second), columns.weight);
+			float bottom = std::lerp(delta(rows.second, columns.first), delta(rows.second, columns.second), columns.weight);
+			heights.at(r, c) += std::lerp(top, bottom, rows.weight);
+		}
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "heightmap.h"
+
+#define PYRAMID_MIN_SIDE 16	// Coarse levels narrower or shorter than this are skipped, the droplets need room to flow
+
+// Averages every 2x2 block of cells into one cell of a (width + 1) / 2 x (height + 1) / 2 heightmap, the cells of the last
+// row and column of an odd map average the cells they cover
+Heightmap downsample_heightmap(const Heightmap& heights);
+
+// Adds the erosion of a coarse level, after - before, to the heightmap one level finer, interpolated bilinearly between the
+// centers of the coarse cells
+// Modifies: heights
+void add_upsampled_delta(Heightmap& heights, const Heightmap& before, const Heightmap& after);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+// Counter-based random number generator built on the SplitMix64 mixing function
+// Every value is a pure function of (seed, stream, counter), so there is no state to seed or carry around: a droplet can
+// draw its random numbers on any thread, in any order and after being suspended, and still get the same sequence.
+class CounterRng
+{
+public:
+	CounterRng() = default;
+	CounterRng(uint64_t seed, uint64_t stream)
+		: m_key(mix(seed + GOLDEN_GAMMA * mix(stream + GOLDEN_GAMMA)))
+	{}
+
+	// 32 random bits for the given counter
+	uint32_t bits(uint64_t counter) const
+	{
+		return (uint32_t)(mix(m_key + GOLDEN_GAMMA * (counter + 1)) >> 32);
+	}
+
+	// Uniformly distributed float in [min, max)
+	float uniform_float(uint64_t counter, float min, float max) const
+	{
+		return min + (max - min) * ((float)(bits(counter) >> 8) * 0x1p-24f);
+	}
+
+	// Uniformly distributed integer in [min, max], using a multiply-shift instead of a modulo
+	unsigned int uniform_uint(uint64_t counter, unsigned int min, unsigned int max) const
+	{
+		return min + (unsigned int)(((uint64_t)bits(counter) * ((uint64_t)max - min + 1)) >> 32);
+	}
+
+private:
+	static constexpr uint64_t GOLDEN_GAMMA = 0x9e3779b97f4a7c15ull;
+
+	// SplitMix64 finalizer
+	static uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	uint64_t m_key = 0;
+};